@@ -0,0 +1,277 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * microbenchmarks for the playback kernels, built and run by
+ * "./waf bench".  results go to stdout as tab-separated lines:
+ *
+ *   kernel  period  groups  ns/frame  ns/cycle
+ *
+ * each number is the best of BENCH_RUNS runs, which is the one least
+ * disturbed by whatever else the machine was doing.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "engine.h"
+#include "file.h"
+#include "group.h"
+#include "list.h"
+#include "rmonome.h"
+#include "session.h"
+#include "voice.h"
+
+#define BENCH_RATE       48000
+#define BENCH_RUNS       5
+#define BENCH_FRAMES     (1 << 20)  /* frames rendered per run */
+#define BENCH_LOOP_LEN   (BENCH_RATE * 4)
+#define BENCH_MAX_GROUPS 12
+
+/* short enough that the play position wraps several times per period */
+#define BENCH_WRAP_LEN   37
+
+#define BENCH_MIN_PERIOD 16
+#define BENCH_MAX_PERIOD 2048
+
+state_t state;
+
+static const int group_counts[] = {1, 2, 4, 8, BENCH_MAX_GROUPS, 0};
+
+static float *mono_data, *stereo_data;
+static jack_default_audio_sample_t *scratch_l, *scratch_r;
+
+static file_t *loops[BENCH_MAX_GROUPS];
+
+typedef void (*kernel_t)(jack_nframes_t period, void *arg);
+
+static float *make_data(int channels, sf_count_t frames) {
+	float *data;
+	sf_count_t i;
+
+	if( !(data = malloc(sizeof(float) * frames * channels)) ) {
+		fprintf(stderr, "bench: couldn't allocate sample data, aieee!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for( i = 0; i < frames * channels; i++ )
+		data[i] = sinf(i * 0.01f) * 0.5f;
+
+	return data;
+}
+
+static file_t *make_file(float *data, sf_count_t frames, int channels, sf_count_t rate) {
+	file_t *f;
+
+	if( !(f = file_new_from_buffer(data, frames, channels, rate)) ) {
+		fprintf(stderr, "bench: couldn't create a file, aieee!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* file_process() scales by the group's volume */
+	f->group = &state.groups[0];
+	return f;
+}
+
+/**
+ * a session with one stereo loop per group, so that engine_process()
+ * has something to chew on without touching the disk.
+ */
+
+static void setup_engine() {
+	jack_default_audio_sample_t *bufs;
+	session_t *session;
+	file_t *f;
+	int i;
+
+	state.sample_rate = BENCH_RATE;
+	state.config.cols = BENCH_MAX_GROUPS + 4;
+	state.config.rows = BENCH_MAX_GROUPS + 1;
+
+	state.group_count = BENCH_MAX_GROUPS;
+	state.groups   = group_array_new(BENCH_MAX_GROUPS);
+	state.patterns = list_new();
+	list_init(&state.sessions);
+
+	session = session_new("bench.rv");
+	session->bpm = 120;
+	session->beat_multiplier = 1;
+	session->cols = state.config.cols;
+
+	bufs = calloc(sizeof(jack_default_audio_sample_t), BENCH_MAX_PERIOD * 2 * BENCH_MAX_GROUPS);
+
+	for( i = 0; i < BENCH_MAX_GROUPS; i++ ) {
+		state.groups[i].output_buffers[0] = bufs + (BENCH_MAX_PERIOD * 2 * i);
+		state.groups[i].output_buffers[1] = state.groups[i].output_buffers[0] + BENCH_MAX_PERIOD;
+
+		f = loops[i] = make_file(stereo_data, BENCH_LOOP_LEN, 2, BENCH_RATE);
+		f->group    = &state.groups[i];
+		f->y        = i + 1;
+		f->row_span = 1;
+		f->columns  = session->cols;
+
+		list_push(&session->files, TAIL, f);
+	}
+
+	session_activate(session);
+
+	if( r_monome_init_offline() ) {
+		fprintf(stderr, "bench: couldn't set up the engine, aieee!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void set_active_loops(int count) {
+	int i;
+
+	for( i = 0; i < BENCH_MAX_GROUPS; i++ ) {
+		if( i < count ) {
+			loops[i]->new_offset = 0;
+			file_seek(loops[i]);
+		} else
+			file_deactivate(loops[i]);
+	}
+}
+
+/**
+ * kernels
+ */
+
+static void bench_file_process(jack_nframes_t period, void *arg) {
+	jack_default_audio_sample_t *buffers[2] = {scratch_l, scratch_r};
+	file_t *f = arg;
+
+	f->voice->process_cb(f->voice, f->group, buffers, period, BENCH_RATE);
+}
+
+static void bench_play_pos(jack_nframes_t period, void *arg) {
+	file_t *f = arg;
+	jack_nframes_t i;
+
+	for( i = 0; i < period; i++ )
+		voice_inc_play_pos(f->voice, 1);
+}
+
+static void bench_engine(jack_nframes_t period, void *arg) {
+	engine_cycle_t cycle;
+	int j;
+
+	/* as if JACK had handed over new buffers, so that quiet groups get
+	   zeroed every time rather than only on the first cycle */
+	for( j = 0; j < state.group_count; j++ )
+		state.groups[j].silent = 0;
+
+	cycle.nframes    = period;
+	cycle.rate       = BENCH_RATE;
+	cycle.group_ns   = NULL;
+	cycle.clock_us   = 0;
+	cycle.events     = NULL;
+	cycle.nevents    = 0;
+	cycle.want_clock = 0;
+	cycle.input[0]   = NULL;
+	cycle.input[1]   = NULL;
+
+	engine_process(&cycle);
+}
+
+static void run(const char *name, kernel_t kernel, void *arg, jack_nframes_t period, int groups) {
+	uint64_t t, best;
+	int cycles, i, r;
+
+	cycles = BENCH_FRAMES / period;
+	best   = UINT64_MAX;
+
+	/* once through to warm the caches */
+	for( i = 0; i < cycles; i++ )
+		kernel(period, arg);
+
+	for( r = 0; r < BENCH_RUNS; r++ ) {
+		t = engine_now_ns();
+
+		for( i = 0; i < cycles; i++ )
+			kernel(period, arg);
+
+		if( (t = engine_now_ns() - t) < best )
+			best = t;
+	}
+
+	printf("%s\t%u\t%d\t%.3f\t%.1f\n", name, period, groups,
+	       best / (double) (cycles * period), best / (double) cycles);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	file_t *mono, *stereo, *wrap, *wrap_rev;
+	jack_nframes_t period;
+	const int *g;
+
+#ifdef HAVE_SRC
+	file_t *src;
+#endif
+
+	mono_data   = make_data(1, BENCH_LOOP_LEN);
+	stereo_data = make_data(2, BENCH_LOOP_LEN);
+
+	scratch_l = calloc(sizeof(jack_default_audio_sample_t), BENCH_MAX_PERIOD);
+	scratch_r = calloc(sizeof(jack_default_audio_sample_t), BENCH_MAX_PERIOD);
+
+	setup_engine();
+
+	mono     = make_file(mono_data, BENCH_LOOP_LEN, 1, BENCH_RATE);
+	stereo   = make_file(stereo_data, BENCH_LOOP_LEN, 2, BENCH_RATE);
+	wrap     = make_file(stereo_data, BENCH_WRAP_LEN, 2, BENCH_RATE);
+	wrap_rev = make_file(stereo_data, BENCH_WRAP_LEN, 2, BENCH_RATE);
+	wrap_rev->voice->play_direction = FILE_PLAY_DIRECTION_REVERSE;
+
+#ifdef HAVE_SRC
+	/* a 44.1k loop played back at 48k goes through libsamplerate */
+	src = make_file(stereo_data, BENCH_LOOP_LEN, 2, 44100);
+#endif
+
+	printf("# kernel\tperiod\tgroups\tns_per_frame\tns_per_cycle\n");
+
+	for( period = BENCH_MIN_PERIOD; period <= BENCH_MAX_PERIOD; period *= 2 ) {
+		run("file_process_mono", bench_file_process, mono, period, 1);
+		run("file_process_stereo", bench_file_process, stereo, period, 1);
+#ifdef HAVE_SRC
+		run("file_process_src", bench_file_process, src, period, 1);
+#endif
+		run("play_pos_wrap", bench_play_pos, wrap, period, 1);
+		run("play_pos_wrap_reverse", bench_play_pos, wrap_rev, period, 1);
+
+		/* with nothing playing this is the buffer zeroing and the
+		   quantize bookkeeping on their own */
+		for( g = group_counts; *g; g++ ) {
+			state.group_count = *g;
+
+			set_active_loops(0);
+			run("engine_idle", bench_engine, NULL, period, *g);
+
+			set_active_loops(*g);
+			run("engine_playing", bench_engine, NULL, period, *g);
+		}
+
+		state.group_count = BENCH_MAX_GROUPS;
+	}
+
+	return 0;
+}
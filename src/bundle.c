@@ -0,0 +1,526 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * a bundle (.rvb) is a whole setlist compiled down to one file which
+ * can be mapped and used as-is:
+ *
+ *   header
+ *   session table    (struct bundle_session * session_count)
+ *   file table       (struct bundle_file * file_count)
+ *   quantize table   (double * group_count * session_count)
+ *   channel table    (uint32_t * group_count)
+ *   string table     (NUL-terminated paths)
+ *   pcm              (interleaved float, each file page-aligned)
+ *
+ * every offset is from the start of the bundle.  the bundle is written
+ * in native byte order, it's meant to be compiled on the machine that
+ * plays it.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+#ifdef HAVE_SRC
+#include <samplerate.h>
+#endif
+
+#include "bundle.h"
+#include "sample.h"
+#include "file.h"
+#include "group.h"
+#include "list.h"
+#include "session.h"
+#include "util.h"
+
+#define BUNDLE_MAGIC   "rvb\n"
+#define BUNDLE_VERSION 3
+
+#define BUNDLE_PAGE_SIZE 4096
+#define page_align(x) (((x) + BUNDLE_PAGE_SIZE - 1) & ~((uint64_t) BUNDLE_PAGE_SIZE - 1))
+
+extern state_t state;
+
+struct bundle_header {
+	char magic[4];
+	uint32_t version;
+
+	uint32_t sample_rate;
+	uint32_t group_count;
+	uint32_t session_count;
+	uint32_t file_count;
+
+	uint64_t sessions_offset;
+	uint64_t files_offset;
+	uint64_t quantize_offset;  /* group_count doubles per session */
+	uint64_t channels_offset;  /* group_count uint32s */
+	uint64_t strings_offset;
+	uint64_t strings_size;
+	uint64_t size;
+};
+
+struct bundle_session {
+	double bpm;
+	double beat_multiplier;
+
+	uint32_t cols;
+	int32_t pattern_lengths[2];
+
+	uint32_t first_file;
+	uint32_t file_count;
+};
+
+struct bundle_file {
+	uint64_t data_offset;
+	uint64_t frames;
+
+	uint32_t channels;
+	uint32_t sample_rate;
+	double speed;
+
+	int32_t y;
+	int32_t row_span;
+	uint32_t columns;
+	uint32_t group;
+	uint32_t reverse;
+
+	uint32_t path_offset;
+};
+
+int bundle_is_bundle(const char *path) {
+	char magic[4];
+	int fd, ret;
+
+	if( (fd = open(path, O_RDONLY)) < 0 )
+		return 0;
+
+	ret = ( read(fd, magic, sizeof(magic)) == sizeof(magic)
+	        && !memcmp(magic, BUNDLE_MAGIC, sizeof(magic)) );
+
+	close(fd);
+	return ret;
+}
+
+/**
+ * compiling
+ */
+
+static float *resample(file_t *f, jack_nframes_t sample_rate, sf_count_t *frames) {
+#ifdef HAVE_SRC
+	SRC_DATA data;
+	float *out;
+	int err;
+
+	*frames = f->voice->file_length;
+
+	if( f->voice->sample_rate == sample_rate )
+		return f->voice->file_data;
+
+	data.src_ratio     = sample_rate / (double) f->voice->sample_rate;
+	data.input_frames  = f->voice->file_length;
+	data.output_frames = lrint(ceil(f->voice->file_length * data.src_ratio));
+	data.data_in       = f->voice->file_data;
+	data.end_of_input  = 1;
+
+	if( !(out = calloc(sizeof(float), data.output_frames * f->voice->channels)) )
+		return NULL;
+
+	data.data_out = out;
+
+	if( (err = src_simple(&data, SRC_SINC_BEST_QUALITY, f->voice->channels)) ) {
+		printf("bundle: couldn't resample \"%s\": %s\n", f->path, src_strerror(err));
+		free(out);
+		return NULL;
+	}
+
+	*frames = data.output_frames_gen;
+	return out;
+#else
+	/* without libsamplerate the pcm goes in at its native rate and
+	   gets played back that way, same as a regular session. */
+	*frames = f->voice->file_length;
+	return f->voice->file_data;
+#endif
+}
+
+static int write_at(FILE *out, uint64_t offset, const void *buf, size_t len) {
+	if( fseeko(out, offset, SEEK_SET) )
+		return 1;
+
+	return fwrite(buf, 1, len, out) != len;
+}
+
+int bundle_compile(const char *path, jack_nframes_t sample_rate) {
+	struct bundle_session *bs, *sessions;
+	struct bundle_file *bf, *files;
+	struct bundle_header hdr;
+
+	uint64_t strings_size, pcm;
+	uint32_t session_count, file_count, skipped, i, j, k;
+	sf_count_t frames;
+
+	list_t *sessions_list = &state.sessions, *files_list;
+	list_member_t *m, *n;
+	file_t **loaded, *f;
+	uint32_t *channels;
+	double *quantize;
+	session_t *s;
+	float *data;
+	FILE *out;
+	int ret;
+
+	session_count = file_count = skipped = 0;
+	strings_size  = 0;
+
+	list_foreach_raw(sessions_list, m) {
+		s = SESSION_T(m);
+		files_list = &s->files;
+		session_count++;
+
+		list_foreach(files_list, n, f) {
+			/* there's nothing in a capture slot to store yet */
+			if( f->capture ) {
+				skipped++;
+				continue;
+			}
+
+			file_count++;
+			strings_size += strlen(f->path) + 1;
+		}
+	}
+
+	sessions = calloc(sizeof(struct bundle_session), session_count);
+	files    = calloc(sizeof(struct bundle_file), file_count);
+	loaded   = calloc(sizeof(file_t *), file_count);
+	quantize = calloc(sizeof(double), (size_t) session_count * state.group_count + 1);
+	channels = calloc(sizeof(uint32_t), state.group_count + 1);
+
+	if( !sessions || !files || !loaded || !quantize || !channels ) {
+		fprintf(stderr, "bundle: couldn't allocate tables, aieee!\n");
+		ret = 1;
+		goto out_free;
+	}
+
+	if( !(out = fopen(path, "wb")) ) {
+		perror("bundle: couldn't open output file");
+		ret = 1;
+		goto out_free;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, BUNDLE_MAGIC, sizeof(hdr.magic));
+
+	hdr.version         = BUNDLE_VERSION;
+	hdr.sample_rate     = sample_rate;
+	hdr.group_count     = state.group_count;
+	hdr.session_count   = session_count;
+	hdr.file_count      = file_count;
+	hdr.sessions_offset = sizeof(hdr);
+	hdr.files_offset    = hdr.sessions_offset + sizeof(struct bundle_session) * session_count;
+	hdr.quantize_offset = hdr.files_offset + sizeof(struct bundle_file) * file_count;
+	hdr.channels_offset = hdr.quantize_offset + sizeof(double) * session_count * state.group_count;
+	hdr.strings_offset  = hdr.channels_offset + sizeof(uint32_t) * state.group_count;
+	hdr.strings_size    = strings_size;
+
+	for( k = 0; k < state.group_count; k++ )
+		channels[k] = state.groups[k].channels;
+
+	pcm = page_align(hdr.strings_offset + strings_size);
+	strings_size = 0;
+	ret = 1;
+	i = j = 0;
+
+	list_foreach_raw(sessions_list, m) {
+		s  = SESSION_T(m);
+		bs = &sessions[i++];
+		files_list = &s->files;
+
+		bs->bpm                = s->bpm;
+		bs->beat_multiplier    = s->beat_multiplier;
+		bs->cols               = s->cols;
+		bs->pattern_lengths[0] = s->pattern_lengths[0];
+		bs->pattern_lengths[1] = s->pattern_lengths[1];
+		bs->first_file         = j;
+
+		for( k = 0; k < state.group_count; k++ )
+			quantize[(i - 1) * state.group_count + k] = ( s->group_quantize )
+				? s->group_quantize[k] : SESSION_QUANTIZE_INHERIT;
+
+		list_foreach(files_list, n, f) {
+			if( f->capture )
+				continue;
+
+			bf = &files[j];
+			loaded[j++] = f;
+
+			bf->speed       = f->voice->speed;
+			bf->y           = f->y;
+			bf->row_span    = f->row_span;
+			bf->columns     = f->columns;
+			bf->group       = f->group - state.groups + 1;
+			bf->reverse     = ( f->voice->play_direction == FILE_PLAY_DIRECTION_REVERSE );
+			bf->channels    = f->voice->channels;
+			bf->path_offset = strings_size;
+
+			if( write_at(out, hdr.strings_offset + strings_size, f->path, strlen(f->path) + 1) )
+				goto out_write;
+
+			strings_size += strlen(f->path) + 1;
+		}
+
+		bs->file_count = j - bs->first_file;
+	}
+
+	for( j = 0; j < file_count; j++ ) {
+		f  = loaded[j];
+		bf = &files[j];
+
+		/* the same loop is often mapped more than once in a setlist,
+		   only store its pcm the first time around. */
+		for( i = 0; i < j; i++ )
+			if( !strcmp(loaded[i]->path, f->path) )
+				break;
+
+		if( i < j ) {
+			bf->data_offset = files[i].data_offset;
+			bf->frames      = files[i].frames;
+			bf->sample_rate = files[i].sample_rate;
+			continue;
+		}
+
+		if( !(data = resample(f, sample_rate, &frames)) )
+			goto out_write;
+
+		bf->data_offset = pcm;
+		bf->frames      = frames;
+		bf->sample_rate = ( data == f->voice->file_data ) ? f->voice->sample_rate : sample_rate;
+
+		i = write_at(out, pcm, data, sizeof(float) * frames * f->voice->channels);
+
+		if( data != f->voice->file_data )
+			free(data);
+
+		if( i )
+			goto out_write;
+
+		pcm = page_align(pcm + sizeof(float) * frames * f->voice->channels);
+	}
+
+	hdr.size = pcm;
+
+	if( write_at(out, 0, &hdr, sizeof(hdr))
+	    || write_at(out, hdr.sessions_offset, sessions, sizeof(struct bundle_session) * session_count)
+	    || write_at(out, hdr.files_offset, files, sizeof(struct bundle_file) * file_count)
+	    || write_at(out, hdr.quantize_offset, quantize, sizeof(double) * session_count * state.group_count)
+	    || write_at(out, hdr.channels_offset, channels, sizeof(uint32_t) * state.group_count)
+	    || ftruncate(fileno(out), hdr.size) )
+		goto out_write;
+
+	printf("    compiled %u sessions, %u loops into %s (%.1f MB)\n",
+	       session_count, file_count, path, hdr.size / 1048576.0);
+
+	if( skipped )
+		printf("    (left out %u capture slots, bundles can't hold them)\n", skipped);
+	ret = 0;
+
+out_write:
+	if( ret )
+		fprintf(stderr, "bundle: error writing %s\n", path);
+
+	if( fclose(out) )
+		ret = 1;
+
+out_free:
+	free(sessions);
+	free(files);
+	free(loaded);
+	free(quantize);
+	free(channels);
+
+	return ret;
+}
+
+/**
+ * loading
+ */
+
+#define in_bounds(off, len, size) ((off) <= (size) && (len) <= (size) - (off))
+
+static int check_header(const struct bundle_header *hdr, uint64_t size) {
+	if( size < sizeof(*hdr) || memcmp(hdr->magic, BUNDLE_MAGIC, sizeof(hdr->magic)) )
+		return 1;
+
+	if( hdr->version != BUNDLE_VERSION ) {
+		printf("bundle: version %u is unsupported (expected %u), please recompile it\n",
+		       hdr->version, BUNDLE_VERSION);
+		return 1;
+	}
+
+	if( hdr->size > size
+	    || !in_bounds(hdr->sessions_offset, sizeof(struct bundle_session) * (uint64_t) hdr->session_count, size)
+	    || !in_bounds(hdr->files_offset, sizeof(struct bundle_file) * (uint64_t) hdr->file_count, size)
+	    || !in_bounds(hdr->quantize_offset, sizeof(double) * (uint64_t) hdr->session_count * hdr->group_count, size)
+	    || !in_bounds(hdr->channels_offset, sizeof(uint32_t) * (uint64_t) hdr->group_count, size)
+	    || !in_bounds(hdr->strings_offset, hdr->strings_size, size) )
+		return 1;
+
+	/* every path has to be terminated inside the string table */
+	if( hdr->strings_size && ((const char *) hdr)[hdr->strings_offset + hdr->strings_size - 1] )
+		return 1;
+
+	return 0;
+}
+
+int bundle_load(const char *path) {
+	const struct bundle_session *sessions, *bs;
+	const struct bundle_file *files, *bf;
+	const struct bundle_header *hdr;
+	const uint32_t *channels;
+	const double *quantize;
+
+	uint32_t i, j, group;
+	const char *strings;
+	session_t *session;
+	struct stat st;
+	char *base;
+	file_t *f;
+	int fd;
+
+	if( (fd = open(path, O_RDONLY)) < 0 )
+		return 1;
+
+	if( fstat(fd, &st) < 0 ) {
+		close(fd);
+		return 1;
+	}
+
+	/* MAP_POPULATE so that the whole set is paged in up front rather
+	   than on first touch from the jack thread. */
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+
+	if( base == MAP_FAILED )
+		return 1;
+
+	sample_lock(base, st.st_size);
+
+	hdr = (const struct bundle_header *) base;
+
+	if( check_header(hdr, st.st_size) ) {
+		printf("bundle: %s is corrupt or truncated\n", path);
+		munmap(base, st.st_size);
+		return 1;
+	}
+
+	sessions = (const struct bundle_session *) (base + hdr->sessions_offset);
+	files    = (const struct bundle_file *) (base + hdr->files_offset);
+	quantize = (const double *) (base + hdr->quantize_offset);
+	channels = (const uint32_t *) (base + hdr->channels_offset);
+	strings  = base + hdr->strings_offset;
+
+	if( !state.group_count )
+		state.group_count = hdr->group_count;
+
+	if( !state.groups )
+		state.groups = group_array_new(state.group_count);
+
+	for( j = 0; j < hdr->group_count && j < state.group_count; j++ )
+		state.groups[j].channels = MIN(MAX(channels[j], 1), GROUP_MAX_CHANNELS);
+
+	for( i = 0; i < hdr->session_count; i++ ) {
+		bs = &sessions[i];
+
+		if( !(session = session_new(path)) ) {
+			fprintf(stderr, "couldn't allocate session, aieee!\n");
+
+			/* the sessions before this one play straight out of the
+			   mapping, so it has to stay if there are any */
+			if( i )
+				break;
+
+			munmap(base, st.st_size);
+			return 1;
+		}
+
+		session->bpm                = bs->bpm;
+		session->beat_multiplier    = bs->beat_multiplier;
+		session->cols               = bs->cols;
+		session->pattern_lengths[0] = bs->pattern_lengths[0];
+		session->pattern_lengths[1] = bs->pattern_lengths[1];
+
+		for( j = 0; j < hdr->group_count && j < state.group_count; j++ ) {
+			if( quantize[i * hdr->group_count + j] < 0 )
+				continue;
+
+			if( !session->group_quantize && session_group_quantize_new(session) )
+				break;
+
+			session->group_quantize[j] = quantize[i * hdr->group_count + j];
+		}
+
+		for( j = bs->first_file; j < bs->first_file + bs->file_count && j < hdr->file_count; j++ ) {
+			bf = &files[j];
+
+			/* channels and frames first, so that the size can't wrap */
+			if( !bf->channels || bf->channels > FILE_MAX_CHANNELS
+			    || bf->frames > hdr->size / (sizeof(float) * bf->channels)
+			    || !in_bounds(bf->data_offset, sizeof(float) * bf->frames * bf->channels, hdr->size)
+			    || bf->path_offset >= hdr->strings_size ) {
+				printf("bundle: loop %u in %s is corrupt, skipping it\n", j, path);
+				continue;
+			}
+
+			/* row 0 is the control row */
+			if( bf->y < 1 || bf->y >= state.config.rows
+			    || bf->row_span < 1 || bf->row_span > state.config.rows ) {
+				printf("bundle: loop %u in %s doesn't fit on the grid, skipping it\n", j, path);
+				continue;
+			}
+
+			f = file_new_from_buffer((float *) (base + bf->data_offset),
+			                         bf->frames, bf->channels, bf->sample_rate);
+
+			if( !f )
+				continue;
+
+			group = MIN(MAX(bf->group, 1), state.group_count);
+
+			f->path     = (char *) strings + bf->path_offset;
+			f->row_span = bf->row_span;
+			f->columns  = bf->columns;
+			f->y        = bf->y;
+			f->group    = &state.groups[group - 1];
+
+			f->voice->speed = bf->speed;
+			f->voice->play_direction = ( bf->reverse )
+				? FILE_PLAY_DIRECTION_REVERSE : FILE_PLAY_DIRECTION_FORWARD;
+
+			list_push(&session->files, TAIL, f);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,563 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sndfile.h>
+
+#include "capture.h"
+#include "engine.h"
+#include "file.h"
+#include "list.h"
+#include "pattern.h"
+#include "rmonome.h"
+#include "sample.h"
+#include "util.h"
+
+extern state_t state;
+
+/* every slot in every session, for the writer thread to look through.
+   bounces add to the end of this as they're made. */
+static file_t *slots[CAPTURE_MAX_SLOTS];
+static int slot_count = 0;
+
+/* slots being recorded into.  only the engine touches these. */
+static file_t *recording[CAPTURE_MAX_RECORDING];
+static int recording_count = 0;
+
+/* bounces that have their pattern, waiting to punch in or recording,
+   and the groups they record from, which nothing but the pattern gets
+   to change until they're done.  only the engine touches these. */
+static file_t *bouncing[CAPTURE_MAX_RECORDING];
+static int bouncing_count = 0;
+static uint32_t locked = 0;
+
+static pthread_t writer_thread;
+static sem_t writer_sem;
+static int writer_running = 0;
+
+static capture_state_t get_state(file_t *self) {
+	return __atomic_load_n(&self->capture->state, __ATOMIC_ACQUIRE);
+}
+
+static void set_state(file_t *self, capture_state_t nstate) {
+	__atomic_store_n(&self->capture->state, nstate, __ATOMIC_RELEASE);
+}
+
+static void save(file_t *self) {
+	capture_t *c = self->capture;
+	char stamp[32], *path;
+	SF_INFO info;
+	SNDFILE *snd;
+	time_t now;
+
+	now = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+
+	if( asprintf(&path, "%s/capture-row%d-%s-%d.wav", c->dirname, self->y, stamp, c->takes) < 0 ) {
+		fprintf(stderr, "capture: couldn't allocate string buffer, aieee!\n");
+		return;
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.samplerate = self->voice->sample_rate;
+	info.channels   = self->voice->channels;
+	info.format     = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+
+	if( !(snd = sf_open(path, SFM_WRITE, &info)) ) {
+		printf("capture: couldn't open \"%s\" for writing: %s\n", path, sf_strerror(NULL));
+		free(path);
+		return;
+	}
+
+	if( sf_writef_float(snd, self->voice->file_data, c->frames) != c->frames )
+		printf("capture: error writing \"%s\": %s\n", path, sf_strerror(snd));
+	else
+		printf("capture: saved row %d to %s\n", self->y, path);
+
+	sf_close(snd);
+	free(path);
+}
+
+static void *writer_loop(void *user_data) {
+	int i, count;
+
+	for(;;) {
+		while( sem_wait(&writer_sem) );
+
+		count = __atomic_load_n(&slot_count, __ATOMIC_ACQUIRE);
+
+		for( i = 0; i < count; i++ ) {
+			if( get_state(slots[i]) != CAPTURE_SAVING )
+				continue;
+
+			save(slots[i]);
+			set_state(slots[i], CAPTURE_READY);
+		}
+	}
+
+	return NULL;
+}
+
+static void bounce_done(file_t *self) {
+	capture_t *c = self->capture;
+	int i;
+
+	locked = 0;
+
+	for( i = 0; i < bouncing_count; ) {
+		if( bouncing[i] == self ) {
+			bouncing[i] = bouncing[--bouncing_count];
+			continue;
+		}
+
+		locked |= bouncing[i++]->capture->groups;
+	}
+
+	/* from here on it's an ordinary slot that records from capture_in */
+	__atomic_store_n(&c->pattern->bounce, NULL, __ATOMIC_RELEASE);
+	c->groups  = 0;
+	c->pattern = NULL;
+}
+
+static void punch_in(file_t *self) {
+	capture_t *c = self->capture;
+
+	if( recording_count == CAPTURE_MAX_RECORDING ) {
+		if( c->pattern )
+			bounce_done(self);
+
+		set_state(self, ( c->takes ) ? CAPTURE_READY : CAPTURE_EMPTY);
+		return;
+	}
+
+	/* the old take stops while the new one goes down */
+	if( file_is_active(self) )
+		file_deactivate(self);
+
+	c->recorded = 0;
+	recording[recording_count++] = self;
+	set_state(self, CAPTURE_RECORDING);
+}
+
+static void replace_pattern(file_t *self) {
+	capture_t *c = self->capture;
+	pattern_t *p = c->pattern;
+	file_t *f;
+	int j;
+
+	/* the slot takes over its own group, the pattern's others stop */
+	for( j = 0; j < state.group_count; j++ ) {
+		if( !(c->groups & (1 << j)) || &state.groups[j] == self->group )
+			continue;
+
+		if( (f = state.groups[j].active_loop) && file_is_active(f) )
+			file_deactivate(f);
+	}
+
+	bounce_done(self);
+	pattern_stop(p);
+}
+
+static void punch_out(file_t *self) {
+	self->capture->takes++;
+	set_state(self, CAPTURE_SAVING);
+
+	if( self->capture->pattern )
+		replace_pattern(self);
+
+	/* the take loops from the top, starting on the frame after its
+	   last one */
+	self->new_offset = ( self->voice->play_direction == FILE_PLAY_DIRECTION_REVERSE )
+		? self->voice->file_length - 1 : 0;
+	file_seek(self);
+
+	sem_post(&writer_sem);
+}
+
+static void arm(file_t *self) {
+	set_state(self, CAPTURE_ARMED);
+	file_on_quantize(self, punch_in);
+}
+
+/**
+ * only presses on the grid itself come through here, on the input
+ * thread, which is the only thing that touches held.  MIDI cuts and
+ * pattern playback only ever send button downs, so they'd never let go
+ * of the slot, and neither of them gets to record over a take anyway.
+ */
+int capture_grid_in(file_t *self, uint_t type) {
+	capture_t *c = self->capture;
+
+	if( type == MONOME_BUTTON_UP ) {
+		if( c->held > 0 )
+			c->held--;
+
+		return 0;
+	}
+
+	c->held++;
+
+	switch( get_state(self) ) {
+	case CAPTURE_EMPTY:
+		arm(self);
+		return 1;
+
+	case CAPTURE_ARMED:
+		/* a group off or a cut took the place of the punch-in before
+		   it got to run (bounces don't go through the quantizer) */
+		if( !c->pattern && self->quantize_cb != punch_in )
+			arm(self);
+
+		return 1;
+
+	case CAPTURE_RECORDING:
+		return 1;
+
+	case CAPTURE_SAVING:
+		/* cutting is fine, but the take can't be overwritten until
+		   it's on disk */
+		return 0;
+
+	case CAPTURE_READY:
+		/* holding one button down and pressing another records over
+		   the take, a single press just cuts */
+		if( c->held < 2 )
+			return 0;
+
+		arm(self);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* whether there's a take to cut into */
+int capture_can_cut(file_t *self) {
+	switch( get_state(self) ) {
+	case CAPTURE_SAVING:
+	case CAPTURE_READY:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+jack_nframes_t capture_block(jack_nframes_t nframes) {
+	sf_count_t left;
+	capture_t *c;
+	int i;
+
+	for( i = 0; i < recording_count; i++ ) {
+		c = recording[i]->capture;
+		left = c->frames - c->recorded;
+
+		if( left < nframes )
+			nframes = left;
+	}
+
+	return nframes;
+}
+
+int capture_locked(const group_t *group) {
+	return !!(locked & (1 << group->idx));
+}
+
+/* the groups bounces are recording from right now */
+uint32_t capture_groups() {
+	uint32_t groups = 0;
+	int i;
+
+	for( i = 0; i < recording_count; i++ )
+		groups |= recording[i]->capture->groups;
+
+	return groups;
+}
+
+void capture_bounce_start(file_t *self) {
+	if( get_state(self) == CAPTURE_ARMED )
+		punch_in(self);
+}
+
+/* sums the groups into dest, their channels paired off with its own
+   as described in group.h */
+static void record_groups(float *dest, int channels, uint32_t groups,
+                          jack_nframes_t offset, jack_nframes_t nframes) {
+	const jack_default_audio_sample_t *in;
+	jack_nframes_t i;
+	group_t *g;
+	int j, k;
+
+	memset(dest, 0, sizeof(float) * nframes * channels);
+
+	for( j = 0; j < state.group_count; j++ ) {
+		if( !(groups & (1 << j)) )
+			continue;
+
+		g = &state.groups[j];
+
+		for( k = 0; k < MAX(g->channels, channels); k++ ) {
+			in = g->output_buffers[k % g->channels] + offset;
+
+			for( i = 0; i < nframes; i++ )
+				dest[i * channels + k % channels] += in[i];
+		}
+	}
+}
+
+/* capture_in is stereo, and goes into the slot's channels the same way */
+static void record_input(float *dest, int channels, const jack_default_audio_sample_t *const *input,
+                         jack_nframes_t offset, jack_nframes_t nframes) {
+	const jack_default_audio_sample_t *in;
+	jack_nframes_t i;
+	int k;
+
+	memset(dest, 0, sizeof(float) * nframes * channels);
+
+	for( k = 0; k < MAX(2, channels); k++ ) {
+		in = input[k % 2] + offset;
+
+		for( i = 0; i < nframes; i++ )
+			dest[i * channels + k % channels] += in[i];
+	}
+}
+
+void capture_record(const jack_default_audio_sample_t *const *input, jack_nframes_t offset, jack_nframes_t nframes) {
+	capture_t *c;
+	float *dest;
+	file_t *f;
+	int i;
+
+	for( i = 0; i < recording_count; ) {
+		f = recording[i];
+		c = f->capture;
+		dest = f->voice->file_data + c->recorded * f->voice->channels;
+
+		if( c->groups )
+			record_groups(dest, f->voice->channels, c->groups, offset, nframes);
+		else if( input[0] )
+			record_input(dest, f->voice->channels, input, offset, nframes);
+		else
+			memset(dest, 0, sizeof(float) * nframes * f->voice->channels);
+
+		if( (c->recorded += nframes) < c->frames ) {
+			i++;
+			continue;
+		}
+
+		recording[i] = recording[--recording_count];
+		punch_out(f);
+	}
+}
+
+static int start_writer() {
+	if( writer_running )
+		return 0;
+
+	sem_init(&writer_sem, 0, 0);
+
+	if( pthread_create(&writer_thread, NULL, writer_loop, NULL) ) {
+		fprintf(stderr, "capture: couldn't start the writer thread, aieee!\n");
+		return 1;
+	}
+
+	writer_running = 1;
+	return 0;
+}
+
+/* give a slot its buffer and hand it to the writer thread */
+static int add_slot(file_t *self, sf_count_t frames, jack_nframes_t sample_rate) {
+	if( slot_count == CAPTURE_MAX_SLOTS ) {
+		printf("capture: can't have more than %d capture slots, sorry\n", CAPTURE_MAX_SLOTS);
+		return 1;
+	}
+
+	self->file_data_size = sizeof(float) * frames * self->voice->channels;
+
+	if( !(self->voice->file_data = sample_alloc(self->file_data_size)) ) {
+		fprintf(stderr, "capture: couldn't allocate memory for row %d, aieee!\n", self->y);
+		return 1;
+	}
+
+	self->capture->frames = frames;
+	self->length = self->voice->file_length = frames;
+	self->voice->sample_rate = sample_rate;
+
+	slots[slot_count] = self;
+	__atomic_store_n(&slot_count, slot_count + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int capture_prepare(jack_nframes_t sample_rate) {
+	list_t *sessions = &state.sessions, *files;
+	list_member_t *m, *n;
+	sf_count_t frames;
+	capture_t *c;
+	size_t total;
+	file_t *f;
+
+	total = 0;
+
+	list_foreach_raw(sessions, m) {
+		files = &SESSION_T(m)->files;
+
+		list_foreach(files, n, f) {
+			if( !(c = f->capture) )
+				continue;
+
+			frames = lrint(c->beats * (60 / c->bpm) * sample_rate);
+
+			if( add_slot(f, ( frames > 0 ) ? frames : 1, sample_rate) )
+				return 1;
+
+			total += f->file_data_size;
+		}
+	}
+
+	if( !slot_count )
+		return 0;
+
+	if( start_writer() )
+		return 1;
+
+	printf("capture: %d slot%s ready (%.1f MB)\n",
+	       slot_count, ( slot_count == 1 ) ? "" : "s", total / 1048576.0);
+
+	return 0;
+}
+
+/* the engine's half of a bounce: if the pattern's still playing and
+   nothing else got to it first, it plays into the slot from the top */
+static void bounce_attach(void *arg, void *data, double value) {
+	file_t *self = arg;
+	capture_t *c = self->capture;
+	pattern_t *p = c->pattern;
+
+	if( p->status == PATTERN_STATUS_ACTIVE && !p->bounce
+	    && bouncing_count < CAPTURE_MAX_RECORDING ) {
+		bouncing[bouncing_count++] = self;
+		locked |= c->groups;
+
+		__atomic_store_n(&p->bounce, self, __ATOMIC_RELEASE);
+		return;
+	}
+
+	/* otherwise it's left as an ordinary empty slot */
+	c->groups  = 0;
+	c->pattern = NULL;
+	set_state(self, CAPTURE_EMPTY);
+}
+
+int capture_bounce(pattern_t *pattern, int y) {
+	session_t *session = state.active_session;
+	pattern_step_t *step;
+	list_member_t *m;
+	group_t *g, *target;
+	uint32_t groups;
+	file_t *f;
+	int steps;
+
+	steps  = 0;
+	groups = 0;
+	target = NULL;
+
+	/* steps on the control row are group mutes, the rest are cuts
+	   into a loop, and the first group cut into gets the bounce */
+	for( m = pattern->steps.head.next; m->next; m = m->next ) {
+		step   = PATTERN_STEP_T(m);
+		steps += step->delay;
+
+		if( step->y )
+			g = ((file_t *) step->victim)->group;
+		else
+			g = HANDLER_T(step->victim)->data;
+
+		groups |= 1 << g->idx;
+
+		if( step->y && !target )
+			target = g;
+	}
+
+	if( !steps || !target )
+		return 1;
+
+	/* the take is as wide as the group it'll play in */
+	if( !(f = capture_new(steps * state.snap_delay / (double) state.frames_per_beat,
+	                      target->channels, session)) )
+		return 1;
+
+	f->y        = y;
+	f->row_span = 1;
+	f->columns  = session->cols;
+	f->group    = target;
+	f->voice->speed = 1.0;
+
+	f->capture->groups  = groups;
+	f->capture->pattern = pattern;
+
+	if( start_writer() || add_slot(f, steps * state.snap_delay, state.sample_rate) ) {
+		file_free(f);
+		return 1;
+	}
+
+	list_push(&session->files, TAIL, f);
+
+	set_state(f, CAPTURE_ARMED);
+
+	if( engine_command(bounce_attach, f, NULL, 0) ) {
+		f->capture->groups  = 0;
+		f->capture->pattern = NULL;
+		set_state(f, CAPTURE_EMPTY);
+	}
+
+	return 0;
+}
+
+file_t *capture_new(double beats, int channels, session_t *session) {
+	file_t *self;
+
+	if( !(self = file_new_from_buffer(NULL, 0, channels, 0)) )
+		return NULL;
+
+	if( !(self->capture = calloc(1, sizeof(capture_t))) ) {
+		file_free(self);
+		return NULL;
+	}
+
+	/* the buffer is ours, it just can't be allocated until the sample
+	   rate is known */
+	self->file_data_borrowed = 0;
+
+	self->capture->beats   = beats;
+	self->capture->bpm     = session->bpm;
+	self->capture->dirname = session->dirname;
+
+	return self;
+}
+
+void capture_free(capture_t *self) {
+	free(self);
+}
@@ -16,9 +16,12 @@
  * along with rove.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <assert.h>
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,310 +29,290 @@
 #include <stdio.h>
 
 #include "config_parser.h"
-#include "list.h"
+#include "util.h"
 
-#define BUFLEN 256
+/* numeric values get copied here so strtol() and friends have
+   something NUL-terminated to chew on */
+#define NUMBUF_LEN 64
 
 #define COMMENT_SYMBOL     '#'
 #define BLOCK_OPEN_SYMBOL  '['
 #define BLOCK_CLOSE_SYMBOL ']'
 
-typedef enum {
-	COMMENT,
-	KEY,
-	VALUE,
-	BLOCK
-} parse_mode_t;
+#define is_space(c) (c == ' ' || c == '\t' || c == '\r')
 
-int conf_getvar(const conf_section_t *section, conf_pair_t **current_pair) {
-	const conf_var_t *v;
-	conf_pair_t *p;
-	int i;
+/* FNV-1a */
+static uint32_t hash_key(const char *key, int len) {
+	uint32_t h = 2166136261u;
 
-	/* if we're called incrementally, free the previous key->value pair */
-	if( *current_pair ) {
-		p = *current_pair;
+	while( len-- ) {
+		h ^= (unsigned char) *key++;
+		h *= 16777619u;
+	}
 
-		/* assume that other code holds reference to the value */
-		if( p->var->type != STRING )
-			free(p->value);
+	return h;
+}
 
-		free(p->key);
-		free(p);
-	}
+static void build_var_hash(conf_section_t *s) {
+	const conf_var_t *v;
+	uint32_t h;
 
-	while( (p = list_pop(section->pairs, HEAD)) ) {
-		/* search for a matching var structure */
-		for( i = 0; section->vars[i].key; i++ ) {
-			v = &section->vars[i];
+	memset(s->var_hash, 0, sizeof(s->var_hash));
 
-			if( !strncmp(p->key, v->key, p->klen) ) {
-				p->var = v;
-				*current_pair = p;
+	if( !s->vars )
+		return;
 
-				return v->val;
-			}
-		}
+	for( v = s->vars; v->key; v++ ) {
+		/* bump CONF_HASH_SIZE if a section ever needs more than this */
+		assert(v - s->vars < CONF_HASH_SIZE);
 
-		/* variable in conf file that was not in the array of expected vars */
-		free(p->value);
-		free(p->key);
-		free(p);
-	}
+		h = hash_key(v->key, strlen(v->key));
+
+		while( s->var_hash[h & (CONF_HASH_SIZE - 1)] )
+			h++;
 
-	return 0;
+		s->var_hash[h & (CONF_HASH_SIZE - 1)] = v;
+	}
 }
 
-void conf_default_section_callback(const conf_section_t *section) {
-	conf_pair_t *p;
+static const conf_var_t *find_var(const conf_section_t *s, const char *key, int len) {
 	const conf_var_t *v;
+	uint32_t h;
 	int i;
 
-	if( !section->vars )
-		return;
+	h = hash_key(key, len);
 
-	while( (p = list_pop(section->pairs, HEAD)) ) {
-		/* search for a matching var structure */
-		for( i = 0; section->vars[i].key; i++ ) {
-			v = &section->vars[i];
-			p->var = v;
-
-			if( !strncmp(p->key, v->key, p->klen) ) {
-				switch( v->type ) {
-				case STRING:
-					if( p->value )
-						*((char **) v->dest) = p->value;
-					goto assigned;
-
-				case INT:
-					if( p->value )
-						*((int *) v->dest) = (int) strtol(p->value, NULL, 10);
-					break;
-
-				case LONG:
-					if( p->value )
-						*((long int *) v->dest) = strtol(p->value, NULL, 10);
-					break;
-
-				case DOUBLE:
-					if( p->value )
-						*((double *) v->dest) = strtod(p->value, NULL);
-					break;
-
-				case BOOL:
-					*((int *) v->dest) = (p->vlen) ? 1 : 0;
-					break;
-				}
-
-				break;
-			}
-		}
+	/* the table can be full, so don't go round it more than once */
+	for( i = 0; i < CONF_HASH_SIZE; i++ ) {
+		if( !(v = s->var_hash[h++ & (CONF_HASH_SIZE - 1)]) )
+			break;
 
-		/* if the variable is a string, assume that other code holds reference to the value */
-		free(p->value);
-assigned:
-		free(p->key);
-		free(p);
+		if( !strncmp(v->key, key, len) && !v->key[len] )
+			return v;
 	}
+
+	return NULL;
 }
 
-static void close_block(conf_section_t *s, conf_pair_t *p) {
-	if( p )
-		list_push(s->pairs, HEAD, p);
+static const char *pair_to_cstr(const conf_pair_t *p, char *buf) {
+	int len = MIN(p->vlen, NUMBUF_LEN - 1);
 
-	if( s ) {
-		if( s->section_callback )
-			s->section_callback(s, s->cb_arg);
-		else
-			conf_default_section_callback(s);
+	memcpy(buf, p->value, len);
+	buf[len] = '\0';
 
-		list_free(s->pairs);
-		s->pairs = NULL;
-	}
+	return buf;
 }
 
+long conf_pair_long(const conf_pair_t *p) {
+	char buf[NUMBUF_LEN];
+	return strtol(pair_to_cstr(p, buf), NULL, 10);
+}
 
-static int config_parse(const char *path, conf_section_t *sections, int cd) {
-	char buf[BUFLEN + 1], vbuf[BUFLEN + 1], c;
-	conf_section_t *s = NULL;
-	int fd, len, vlen, i, j, lines;
-	conf_pair_t *p = NULL;
-	parse_mode_t m = KEY;
+double conf_pair_double(const conf_pair_t *p) {
+	char buf[NUMBUF_LEN];
+	return strtod(pair_to_cstr(p, buf), NULL);
+}
 
-	if( (fd = open(path, O_RDONLY)) < 0 )
-		return 1;
+char *conf_pair_strdup(const conf_pair_t *p) {
+	return strndup(p->value, p->vlen);
+}
 
-	if( cd ) 
-		chdir(dirname((char *) path));
+int conf_getvar(const conf_section_t *section, const conf_pair_t **current_pair) {
+	const conf_pair_t *p;
 
-	vlen = 0;
-	lines = 1;
+	/* only pairs that matched a var make it into the array, so this
+	   is just a cursor over them. */
+	p = ( *current_pair ) ? *current_pair + 1 : section->pairs;
 
-	while( (len = read(fd, buf, BUFLEN)) ) {
-		buf[len] = '\0';
+	if( p >= section->pairs + section->npairs )
+		return 0;
 
-		if( len < BUFLEN )
-			len++;
+	*current_pair = p;
+	return p->var->val;
+}
 
-		for( i = 0; i < len; i++ ) {
-			c = buf[i];
+void conf_default_section_callback(const conf_section_t *section) {
+	const conf_pair_t *p;
+	const conf_var_t *v;
+	int i;
 
-			if( !c ) {
-				lines++;
-				goto state_out;
-			}
+	for( i = 0; i < section->npairs; i++ ) {
+		p = &section->pairs[i];
+		v = p->var;
 
-			switch( m ) {
-			case COMMENT:
-				if( c == '\n' )
-					goto state_out;
+		switch( v->type ) {
+		case STRING:
+			*((char **) v->dest) = conf_pair_strdup(p);
+			break;
 
-				break;
+		case INT:
+			*((int *) v->dest) = (int) conf_pair_long(p);
+			break;
+
+		case LONG:
+			*((long int *) v->dest) = conf_pair_long(p);
+			break;
+
+		case DOUBLE:
+			*((double *) v->dest) = conf_pair_double(p);
+			break;
+
+		case BOOL:
+			*((int *) v->dest) = (p->vlen) ? 1 : 0;
+			break;
+		}
+	}
+}
 
-			case KEY:
-				switch( c ) {
-				case ' ':
-				case '\t':
-					continue;
+static void close_block(conf_section_t *s) {
+	if( !s )
+		return;
 
-				case COMMENT_SYMBOL:
-				case '\n':
-				case '=':
-					goto state_out;
+	if( s->section_callback )
+		s->section_callback(s, s->cb_arg);
+	else
+		conf_default_section_callback(s);
 
-				case BLOCK_OPEN_SYMBOL:
-					m = BLOCK;
-					continue;
-				}
+	s->npairs = 0;
+}
 
-				vbuf[vlen++] = c;
+static conf_section_t *open_block(conf_section_t *sections, const char *name, int len) {
+	int i;
 
-				break;
+	for( i = 0; sections[i].block; i++ )
+		if( !strncmp(sections[i].block, name, len) && !sections[i].block[len] ) {
+			sections[i].npairs = 0;
+			return &sections[i];
+		}
 
-			case BLOCK:
-				switch( c ) {
-				case BLOCK_CLOSE_SYMBOL:
-				case COMMENT_SYMBOL:
-				case '\n':
-					goto state_out;
-				}
+	return NULL;
+}
 
-				vbuf[vlen++] = c;
+static void add_pair(conf_section_t *s, const char *key, int klen, const char *value, int vlen,
+                     int line, const char *path) {
+	const conf_var_t *v;
+	conf_pair_t *p;
 
-				break;
+	/* variable in conf file that was not in the array of expected vars */
+	if( !(v = find_var(s, key, klen)) )
+		return;
 
-			case VALUE:
-				switch( c ) {
-				case ' ':
-					if( !vlen )
-						continue;
-					break;
+	if( s->npairs >= CONF_MAX_PAIRS ) {
+		printf("conf: too many variables in [%s] block, ignoring \"%.*s\" on line %d of %s\n",
+		       s->block, klen, key, line, path);
+		return;
+	}
 
-				case COMMENT_SYMBOL:
-				case '\n':
-					goto state_out;
-				}
+	p = &s->pairs[s->npairs++];
+	p->key   = key;
+	p->klen  = klen;
+	p->value = value;
+	p->vlen  = vlen;
+	p->var   = v;
+}
 
-				vbuf[vlen++] = c;
-			}
+static int config_parse(const char *path, conf_section_t *sections, int cd) {
+	const char *buf, *end, *c, *eol, *line_end, *key, *value;
+	int fd, lines, klen, vlen, ret;
+	conf_section_t *s = NULL;
+	struct stat st;
 
-			continue;
+	if( (fd = open(path, O_RDONLY)) < 0 )
+		return 1;
 
-state_out:
-			if( c == '\n' )
-				lines++;
+	if( fstat(fd, &st) < 0 ) {
+		close(fd);
+		return 1;
+	}
 
-			vbuf[vlen] = 0;
+	if( cd )
+		chdir(dirname((char *) path));
 
-			switch( m ) {
-			case BLOCK:
-				if( c != BLOCK_CLOSE_SYMBOL ) {
-					vbuf[vlen] = 0;
-					printf("conf: unterminated block name \"%s\" on line %d of %s\n", vbuf, lines, path);
-					return 1;
-				}
+	if( !st.st_size ) {
+		close(fd);
+		return 0;
+	}
 
-				close_block(s, p);
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
 
-				s = NULL;
-				p = NULL;
+	if( buf == MAP_FAILED )
+		return 1;
 
-				for( j = 0; sections[j].block; j++ )
-					if( !strncmp(vbuf, sections[j].block, vlen) ) {
-						s = &sections[j];
-						s->start_line = lines;
+	madvise((void *) buf, st.st_size, MADV_SEQUENTIAL);
 
-						if( !s->pairs )
-							s->pairs = list_new();
-					}
+	end = buf + st.st_size;
+	ret = 0;
 
-				m = COMMENT;
-				break;
+	for( c = buf, lines = 1; c < end; c = eol + 1, lines++ ) {
+		if( !(eol = memchr(c, '\n', end - c)) )
+			eol = end;
 
-			case COMMENT:
-				m = KEY;
-				continue;
+		if( !(line_end = memchr(c, COMMENT_SYMBOL, eol - c)) )
+			line_end = eol;
 
-			case KEY:
-				switch( c ) {
-				case '=':
-					if( !vlen ) {
-						printf("conf: missing key on line %d of %s\n", lines, path);
-						return 1;
-					}
+		while( c < line_end && is_space(*c) )
+			c++;
 
-					m = VALUE;
-					/* fall through */
+		while( line_end > c && is_space(line_end[-1]) )
+			line_end--;
 
-				case '\n':
-					if( !vlen )
-						continue;
-					break;
+		if( c == line_end )
+			continue;
 
-				case COMMENT_SYMBOL:
-					m = COMMENT;
+		if( *c == BLOCK_OPEN_SYMBOL ) {
+			key = ++c;
 
-					if( !vlen )
-						continue;
-				}
+			if( !(c = memchr(key, BLOCK_CLOSE_SYMBOL, line_end - key)) ) {
+				printf("conf: unterminated block name \"%.*s\" on line %d of %s\n",
+				       (int) (line_end - key), key, lines, path);
+				ret = 1;
+				goto out;
+			}
 
-				if( s ) {
-					if( p )
-						list_push(s->pairs, HEAD, p);
+			close_block(s);
 
-					p = calloc(1, sizeof(conf_pair_t));
-					p->key  = strndup(vbuf, vlen);
-					p->klen = vlen;
-				}
+			if( (s = open_block(sections, key, c - key)) )
+				s->start_line = lines;
 
-				break;
+			continue;
+		}
 
-			case VALUE:
-				if( vbuf[vlen - 1] == ' ' ) {
-					while( vbuf[vlen - 1] == ' ' ) /* strip trailing spaces */
-						vlen--;
+		if( *c == '=' ) {
+			printf("conf: missing key on line %d of %s\n", lines, path);
+			ret = 1;
+			goto out;
+		}
 
-					vbuf[vlen] = 0;
-				}
+		/* pairs outside of any block we care about */
+		if( !s )
+			continue;
 
-				m = ( c == COMMENT_SYMBOL ) ? COMMENT : KEY;
+		for( key = c; c < line_end && *c != '=' && !is_space(*c); c++ );
+		klen = c - key;
 
-				if( p ) {
-					p->value = strndup(vbuf, vlen);
-					p->vlen  = vlen;
-				}
+		while( c < line_end && is_space(*c) )
+			c++;
 
-				break;
-			}
+		/* bare keys (e.g. "reverse") have no value */
+		if( c < line_end && *c == '=' ) {
+			for( c++; c < line_end && is_space(*c); c++ );
 
-			vlen = 0;
+			value = c;
+			vlen  = line_end - c;
+		} else {
+			value = line_end;
+			vlen  = 0;
 		}
+
+		add_pair(s, key, klen, value, vlen, lines, path);
 	}
 
-	close_block(s, p);
-	close(fd);
+	close_block(s);
 
-	return 0;
+out:
+	munmap((void *) buf, st.st_size);
+	return ret;
 }
 
 int conf_load(const char *path, conf_section_t *sections, int cd) {
@@ -343,8 +326,10 @@ int conf_load(const char *path, conf_section_t *sections, int cd) {
 	if( !S_ISREG(buf.st_mode) )
 		return 1;
 
-	for( i = 0; sections[i].block; i++ )
-		sections[i].pairs = NULL;
+	for( i = 0; sections[i].block; i++ ) {
+		sections[i].npairs = 0;
+		build_var_hash(&sections[i]);
+	}
 
 	return config_parse(path, sections, cd);
 }
@@ -0,0 +1,802 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "capture.h"
+#include "engine.h"
+#include "latency.h"
+#include "trace.h"
+#include "file.h"
+#include "group.h"
+#include "list.h"
+#include "util.h"
+#include "pattern.h"
+#include "rmonome.h"
+
+extern state_t state;
+
+/* frames since the last boundary of the session's grid, which patterns
+   step on.  each group keeps its own counter for its own grid. */
+static jack_nframes_t quantize_frames = 0;
+
+/**
+ * grid events are handled on the input thread, but for replays to be
+ * bit-exact every request they make has to land in a well-defined
+ * cycle, and the one that gets logged.  the engine's next frame, whether
+ * the input thread is halfway through an event and which event that is
+ * all live in input_gate, so that starting a cycle is one atomic step
+ * against the input thread starting or finishing an event.  each request
+ * is stamped with the next frame and the event it came from, and a cycle
+ * acts on it unless it was made after the cycle started or its event was
+ * still going when the cycle started.  that means an event is picked up
+ * by the first cycle to start after it's finished, and the fetch in
+ * engine_input_end() that finishes it tells us exactly which one that
+ * is, which is what gets logged.
+ */
+
+#define GATE_BUSY        1ULL
+#define GATE_EVENT_SHIFT 1
+#define GATE_EVENT_MASK  0x7fffULL
+#define GATE_FRAME_SHIFT 16
+
+static uint64_t input_gate = 0;
+
+static uint64_t cycle_start = 0;
+static uint_t cycle_input_event = 0;
+
+/* requests made from the engine thread (pattern playback) are stamped
+   with zero and always visible */
+static __thread uint64_t request_frame = 0;
+static __thread uint_t request_event = 0;
+
+/* when the grid event behind the current request arrived, for the
+   latency histograms */
+static __thread uint64_t request_arrival = 0;
+
+/**
+ * with quantizing turned off, a cut lands on the frame its event
+ * arrived at plus one period.  the cycle running when the event came in
+ * is already computed past that point, so one period on is the earliest
+ * any event can be heard, and adding the same amount to every one of
+ * them keeps the latency constant instead of jittering with where in
+ * the period the press happened.  the engine publishes where each cycle
+ * starts, in frames and microseconds, behind a sequence counter so the
+ * input thread never sees half of an update.
+ */
+
+static uint32_t clock_seq = 0;
+static uint64_t clock_frame = 0;
+static uint64_t clock_us = 0;
+static jack_nframes_t clock_nframes = 0;
+static jack_nframes_t clock_rate = 0;
+
+static __thread uint64_t request_target = ENGINE_NO_TARGET;
+static __thread int request_targeted = 0;
+
+/* offline renders know exactly which frame each event belongs to */
+static __thread uint64_t input_at = 0;
+static __thread uint64_t input_at_target = 0;
+static __thread int input_at_set = 0;
+
+/**
+ * whatever else the input thread changes that the engine plays from
+ * (patterns, sessions) is handed over as a command, stamped the same way
+ * as a request and run at the start of the first cycle that sees it, so
+ * that it happens on the cycle its event gets logged with.  only the
+ * input thread adds to the ring and only the engine takes from it.
+ * commands made anywhere else (by the engine itself, or before it's
+ * started) just run there and then.
+ */
+
+typedef struct {
+	engine_command_callback_t cb;
+	void *arg;
+	void *data;
+	double value;
+
+	uint64_t frame;
+	uint_t event;
+} command_t;
+
+static command_t commands[ENGINE_MAX_COMMANDS];
+static uint32_t commands_head = 0;  /* moved on by the input thread */
+static uint32_t commands_tail = 0;  /* ...and this by the engine */
+
+/**
+ * the engine can't free anything, so what it's done with goes back to
+ * the input thread on a ring going the other way.  nothing's freed until
+ * every command queued so far has been run, so that a command never
+ * finds something it points at gone.
+ */
+
+typedef struct {
+	void *ptr;
+	engine_discard_callback_t cb;
+} discard_t;
+
+static discard_t discards[ENGINE_MAX_DISCARDS];
+static uint32_t discards_head = 0;  /* moved on by the engine */
+static uint32_t discards_tail = 0;  /* ...and this by the input thread */
+
+uint64_t engine_now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t engine_time_us() {
+	/* jack_get_time() keeps us on the same clock as JACK (and its
+	   callback); without a client (rendering offline) we just use the
+	   monotonic clock. */
+	if( state.client )
+		return jack_get_time();
+
+	return engine_now_ns() / 1000;
+}
+
+static void clock_publish(uint64_t frame, uint64_t us, jack_nframes_t nframes, jack_nframes_t rate) {
+	__atomic_add_fetch(&clock_seq, 1, __ATOMIC_SEQ_CST);
+
+	__atomic_store_n(&clock_frame, frame, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock_us, us, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock_nframes, nframes, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock_rate, rate, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&clock_seq, 1, __ATOMIC_SEQ_CST);
+}
+
+static uint64_t arrival_target(uint64_t us) {
+	jack_nframes_t nframes, rate;
+	uint64_t frame, start_us;
+	uint32_t seq;
+	int64_t since;
+
+	do {
+		while( (seq = __atomic_load_n(&clock_seq, __ATOMIC_ACQUIRE)) & 1 );
+
+		frame    = __atomic_load_n(&clock_frame, __ATOMIC_RELAXED);
+		start_us = __atomic_load_n(&clock_us, __ATOMIC_RELAXED);
+		nframes  = __atomic_load_n(&clock_nframes, __ATOMIC_RELAXED);
+		rate     = __atomic_load_n(&clock_rate, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while( seq != __atomic_load_n(&clock_seq, __ATOMIC_RELAXED) );
+
+	if( (since = (int64_t) (us - start_us)) < 0 )
+		since = 0;
+
+	return frame + nframes + (since * rate) / 1000000;
+}
+
+int engine_command(engine_command_callback_t cb, void *arg, void *data, double value) {
+	uint32_t head;
+	command_t *c;
+
+	if( !request_event ) {
+		cb(arg, data, value);
+		return 0;
+	}
+
+	head = commands_head;
+
+	if( head - __atomic_load_n(&commands_tail, __ATOMIC_ACQUIRE) == ENGINE_MAX_COMMANDS ) {
+		printf("engine: too many commands waiting for the engine, dropping one\n");
+		return 1;
+	}
+
+	c = &commands[head % ENGINE_MAX_COMMANDS];
+
+	c->cb    = cb;
+	c->arg   = arg;
+	c->data  = data;
+	c->value = value;
+	c->frame = request_frame;
+	c->event = request_event;
+
+	__atomic_store_n(&commands_head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void process_commands() {
+	uint32_t tail;
+	command_t *c;
+
+	for( tail = commands_tail; tail != __atomic_load_n(&commands_head, __ATOMIC_ACQUIRE); tail++ ) {
+		c = &commands[tail % ENGINE_MAX_COMMANDS];
+
+		/* they're in order, so none after this one are due either */
+		if( !engine_request_visible(c->frame, c->event) )
+			break;
+
+		c->cb(c->arg, c->data, c->value);
+		__atomic_store_n(&commands_tail, tail + 1, __ATOMIC_RELEASE);
+	}
+}
+
+void engine_discard(void *ptr, engine_discard_callback_t cb) {
+	uint32_t head = discards_head;
+	discard_t *d;
+
+	/* better leaked than freed on the audio thread */
+	if( head - __atomic_load_n(&discards_tail, __ATOMIC_ACQUIRE) == ENGINE_MAX_DISCARDS )
+		return;
+
+	d = &discards[head % ENGINE_MAX_DISCARDS];
+	d->ptr = ptr;
+	d->cb  = cb;
+
+	__atomic_store_n(&discards_head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void free_discards() {
+	uint32_t tail;
+	discard_t *d;
+
+	/* the next event will have another go */
+	if( __atomic_load_n(&commands_tail, __ATOMIC_ACQUIRE) != commands_head )
+		return;
+
+	for( tail = discards_tail; tail != __atomic_load_n(&discards_head, __ATOMIC_ACQUIRE); tail++ ) {
+		d = &discards[tail % ENGINE_MAX_DISCARDS];
+		d->cb(d->ptr);
+	}
+
+	__atomic_store_n(&discards_tail, tail, __ATOMIC_RELEASE);
+}
+
+void engine_input_at(uint64_t frame, uint64_t target) {
+	input_at = frame;
+	input_at_target = target;
+	input_at_set = 1;
+}
+
+uint64_t engine_input_begin() {
+	uint64_t gate, busy;
+	uint_t event;
+
+	free_discards();
+
+	request_arrival = engine_time_us();
+	request_targeted = 0;
+
+	/* events are numbered from one, so zero never matches */
+	gate = __atomic_load_n(&input_gate, __ATOMIC_SEQ_CST);
+
+	do {
+		if( !(event = ((gate >> GATE_EVENT_SHIFT) + 1) & GATE_EVENT_MASK) )
+			event = 1;
+
+		busy = (gate & ~(GATE_EVENT_MASK << GATE_EVENT_SHIFT))
+			| ((uint64_t) event << GATE_EVENT_SHIFT) | GATE_BUSY;
+	} while( !__atomic_compare_exchange_n(&input_gate, &gate, busy, 1,
+	                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) );
+
+	request_event = event;
+
+	if( input_at_set ) {
+		request_frame  = input_at;
+		request_target = input_at_target;
+		input_at_set = 0;
+	} else {
+		request_frame  = gate >> GATE_FRAME_SHIFT;
+		request_target = arrival_target(request_arrival);
+	}
+
+	return request_frame;
+}
+
+uint64_t engine_input_end(uint64_t *target) {
+	uint64_t frame;
+
+	/* the next cycle to start is the first one that sees this event
+	   finished, and so the one that acts on it */
+	frame = __atomic_fetch_and(&input_gate, ~GATE_BUSY, __ATOMIC_SEQ_CST)
+		>> GATE_FRAME_SHIFT;
+
+	/* an unquantized cut also gets logged with the frame it lands on,
+	   if that's any later */
+	*target = ( request_targeted && request_target > frame )
+		? request_target : ENGINE_NO_TARGET;
+
+	request_frame = 0;
+	request_event = 0;
+	request_target = ENGINE_NO_TARGET;
+
+	latency_input(engine_time_us() - request_arrival);
+	request_arrival = 0;
+
+	return frame;
+}
+
+uint64_t engine_next_frame() {
+	return __atomic_load_n(&input_gate, __ATOMIC_SEQ_CST) >> GATE_FRAME_SHIFT;
+}
+
+uint64_t engine_request_frame() {
+	return request_frame;
+}
+
+uint_t engine_request_event() {
+	return request_event;
+}
+
+uint64_t engine_request_arrival() {
+	return request_arrival;
+}
+
+uint64_t engine_request_target() {
+	if( request_target == ENGINE_NO_TARGET )
+		return ENGINE_NO_TARGET;
+
+	/* an event that took longer than a period to get here can't land
+	   in the past, so it lands at the start of the first cycle that
+	   sees it instead */
+	if( request_target < request_frame )
+		request_target = request_frame;
+
+	request_targeted = 1;
+	return request_target;
+}
+
+int engine_request_visible(uint64_t frame, uint_t event) {
+	return ( frame <= cycle_start && (!event || event != cycle_input_event) );
+}
+
+/* which of the pending requests a pass over them should fire */
+enum {
+	REQUESTS_CYCLE,  /* file_on_cycle(), at the start of every cycle */
+	REQUESTS_DUE     /* everything whose boundary or frame has come up */
+};
+
+/* the earliest unquantized cut still to come in this cycle, as found by
+   the last REQUESTS_DUE pass */
+static uint64_t next_target = ENGINE_NO_TARGET;
+
+static int request_visible(const engine_cycle_t *cycle, const file_t *f) {
+	if( engine_request_visible(f->quantize_frame, f->quantize_event) )
+		return 1;
+
+	/* live requests are always stamped with a cycle's start frame, but
+	   logs from before the target column was added have unquantized
+	   cuts stamped with their own frame, which can be in the middle of
+	   this cycle. */
+	return ( f->quantize_target != ENGINE_NO_TARGET
+	         && f->quantize_frame > cycle_start
+	         && f->quantize_frame < cycle_start + cycle->nframes );
+}
+
+static int process_file(engine_cycle_t *cycle, file_t *f, int pass, jack_nframes_t offset) {
+	quantize_callback_t cb;
+	engine_fired_t *fired;
+
+	if( !f )
+		return 0;
+
+	if( !(cb = __atomic_load_n(&f->quantize_cb, __ATOMIC_ACQUIRE)) )
+		return 0;
+
+	if( !request_visible(cycle, f) )
+		return 0;
+
+	/* the first cycle that could act on a request is where waiting on
+	   the system ends and waiting on the quantize grid begins */
+	if( f->quantize_seen == ENGINE_NOT_SEEN )
+		f->quantize_seen = cycle_start;
+
+	switch( pass ) {
+	case REQUESTS_CYCLE:
+		if( !f->quantize_immediate )
+			return 0;
+
+		break;
+
+	case REQUESTS_DUE:
+		if( f->quantize_immediate )
+			break;
+
+		if( f->quantize_target != ENGINE_NO_TARGET ) {
+			if( f->quantize_target > cycle_start + offset ) {
+				if( f->quantize_target < next_target )
+					next_target = f->quantize_target;
+
+				return 0;
+			}
+
+			break;
+		}
+
+		if( !f->group->quantize_due ) {
+			f->group->quantize_pending = 1;
+			return 0;
+		}
+
+		break;
+	}
+
+	/* a bounce has the last word on its groups until it's done, so
+	   anything from the grid on them is dropped (see capture.h) */
+	if( f->quantize_event && capture_locked(f->group) ) {
+		file_on_quantize(f, NULL);
+		return 0;
+	}
+
+	if( f->quantize_arrival && cycle->nfired < ENGINE_MAX_FIRED ) {
+		fired = &cycle->fired[cycle->nfired++];
+
+		fired->arrival_us = f->quantize_arrival;
+		fired->seen_frame = f->quantize_seen;
+		fired->frame      = cycle_start + offset;
+	}
+
+	cb(f);
+	file_on_quantize(f, NULL);
+
+	return 1;
+}
+
+static int process_requests(engine_cycle_t *cycle, int pass, jack_nframes_t offset) {
+	int j, next_bit, fired;
+	uint16_t qfield;
+
+	fired = 0;
+
+	if( pass == REQUESTS_DUE ) {
+		next_target = ENGINE_NO_TARGET;
+
+		for( j = 0; j < state.group_count; j++ )
+			state.groups[j].quantize_pending = 0;
+	}
+
+	for( j = 0; j < state.group_count; j++ )
+		fired += process_file(cycle, state.groups[j].active_loop, pass, offset);
+
+	qfield = state.monome->quantize_field >> 1;
+
+	for( j = 0; qfield; qfield >>= next_bit ) {
+		next_bit = ffs(qfield);
+		j += next_bit;
+
+		fired += process_file(cycle, (file_t *) state.monome->callbacks[j].data, pass, offset);
+	}
+
+	return fired;
+}
+
+static void process_patterns() {
+	list_member_t *m;
+
+	list_foreach_raw(state.patterns, m)
+		pattern_process(PATTERN_T(m));
+}
+
+static void process_event(const engine_event_t *e, uint64_t frame) {
+	switch( e->type ) {
+	case ENGINE_EVENT_CUT:
+		/* cuts from here are stamped as always visible, like pattern
+		   playback, and an unquantized group cuts right on the event */
+		trace_instant(TRACE_INPUT, (e->y << 8) | e->x);
+
+		request_target = frame;
+		r_monome_cut(state.monome, e->x, e->y);
+		request_target = ENGINE_NO_TARGET;
+		break;
+
+	case ENGINE_EVENT_VOLUME:
+		if( e->y < state.group_count && !capture_locked(&state.groups[e->y]) )
+			group_set_volume(&state.groups[e->y], e->value);
+
+		break;
+	}
+}
+
+/**
+ * MIDI clock.  ticks are laid out from the last beat, and the beats come
+ * from the session's quantize grid: each boundary adds beat_multiplier
+ * beats, and a boundary that brings that to a whole number is a beat.
+ * that keeps the clock on the same grid cuts and patterns land on, even
+ * when the grid is finer or coarser than a beat.  start goes out on the
+ * first beat after something starts playing, stop as soon as nothing is.
+ */
+
+static double grid_beats = 0;
+static jack_nframes_t beat_frames = 0;  /* frames since the last beat */
+static int beat_ticks = ENGINE_CLOCK_PPQN;  /* ticks sent since then */
+static int clock_running = 0;
+
+static void clock_message(engine_cycle_t *cycle, jack_nframes_t offset, engine_clock_type_t type) {
+	engine_clock_t *c;
+
+	if( cycle->nclock >= ENGINE_MAX_CLOCK )
+		return;
+
+	c = &cycle->clock[cycle->nclock++];
+	c->offset = offset;
+	c->type   = type;
+}
+
+static int anything_playing() {
+	int j;
+
+	for( j = 0; j < state.group_count; j++ )
+		if( state.groups[j].voice )
+			return 1;
+
+	return 0;
+}
+
+static int clock_on_boundary() {
+	int beat;
+
+	beat = ( fabs(grid_beats - rint(grid_beats)) < 1e-6 );
+	grid_beats = (( beat ) ? 0 : grid_beats) + state.beat_multiplier;
+
+	return beat;
+}
+
+static void clock_beat(engine_cycle_t *cycle, jack_nframes_t offset) {
+	/* if the grid got here a little early, the ticks it skipped still
+	   have to go out so that slaves don't lose count */
+	for( ; beat_ticks < ENGINE_CLOCK_PPQN; beat_ticks++ )
+		clock_message(cycle, offset, ENGINE_CLOCK_TICK);
+
+	if( !clock_running && anything_playing() ) {
+		clock_message(cycle, offset, ENGINE_CLOCK_START);
+		clock_running = 1;
+	}
+
+	beat_frames = 0;
+	beat_ticks  = 0;
+}
+
+static void clock_block(engine_cycle_t *cycle, jack_nframes_t offset, jack_nframes_t nframes) {
+	double interval = state.frames_per_beat / (double) ENGINE_CLOCK_PPQN;
+	jack_nframes_t at;
+
+	if( clock_running && !anything_playing() ) {
+		clock_message(cycle, offset, ENGINE_CLOCK_STOP);
+		clock_running = 0;
+	}
+
+	for( ;; beat_ticks++ ) {
+		at = lrint(beat_ticks * interval);
+
+		if( at >= beat_frames + nframes )
+			break;
+
+		clock_message(cycle, offset + (( at > beat_frames ) ? at - beat_frames : 0),
+		              ENGINE_CLOCK_TICK);
+	}
+
+	beat_frames += nframes;
+}
+
+/**
+ * quantize grids.  a grid only has to split the period at its boundaries
+ * when something is waiting on them, so grids count along whether they
+ * split anything or not, and a block can run straight over a boundary
+ * nobody cares about.
+ */
+
+static int grid_boundary(jack_nframes_t *frames, jack_nframes_t snap_delay) {
+	/* the grid got shorter (a faster session came in) and we're already
+	   past where the boundary would be: take it now */
+	if( *frames >= snap_delay )
+		*frames = 0;
+
+	return !*frames;
+}
+
+static void grid_advance(jack_nframes_t *frames, jack_nframes_t snap_delay,
+                         jack_nframes_t nframes, int period_end) {
+	*frames = (*frames + nframes) % snap_delay;
+
+	/* a period that ends a frame short of a boundary has always wrapped
+	   the grid early.  left that way so that renders don't change. */
+	if( period_end && *frames == snap_delay - 1 )
+		*frames = 0;
+}
+
+static int uses_src(const voice_t *v, jack_nframes_t rate) {
+#ifdef HAVE_SRC
+	return ( v->speed != 1 || v->sample_rate != rate );
+#else
+	return 0;
+#endif
+}
+
+void engine_process(engine_cycle_t *cycle) {
+	jack_nframes_t rate, nframes, nframes_left, nframes_offset;
+	int j, k, group_count, period_end, event, beat;
+	uint64_t position, gate;
+	uint32_t bounced;
+	uint64_t t;
+
+	jack_default_audio_sample_t *buffers[GROUP_MAX_CHANNELS];
+
+	group_t *g;
+	voice_t *v;
+
+	group_count = state.group_count;
+	nframes     = cycle->nframes;
+	rate        = cycle->rate;
+
+	cycle->blocks = cycle->voices = cycle->src_voices = cycle->commands = 0;
+	cycle->nfired = cycle->nclock = 0;
+	cycle->start_us = engine_time_us();
+
+	/* move on to the next cycle's frame and see what the input thread
+	   is up to in one go, see the comment at the top. */
+	gate = __atomic_fetch_add(&input_gate, (uint64_t) nframes << GATE_FRAME_SHIFT,
+	                          __ATOMIC_SEQ_CST);
+
+	cycle->start_frame = cycle_start = gate >> GATE_FRAME_SHIFT;
+	cycle_input_event = ( gate & GATE_BUSY )
+		? (gate >> GATE_EVENT_SHIFT) & GATE_EVENT_MASK : 0;
+
+	clock_publish(cycle_start, ( cycle->clock_us ) ? cycle->clock_us : cycle->start_us,
+	              nframes, rate);
+
+	/* pattern buttons, session switches and the like */
+	process_commands();
+
+	/* mutes and the like don't wait for a quantize boundary */
+	cycle->commands += process_requests(cycle, REQUESTS_CYCLE, 0);
+
+	/* zero each group's output buffers, unless they're still silent from
+	   last cycle.  a group that plays anything below starts over. */
+	for( j = 0; j < group_count; j++ ) {
+		g = &state.groups[j];
+
+		if( g->silent >= nframes )
+			continue;
+
+		for( k = 0; k < g->channels; k++ )
+			memset(g->output_buffers[k], 0, sizeof(jack_default_audio_sample_t) * nframes);
+
+		g->silent = nframes;
+	}
+
+	event = 0;
+
+	for( nframes_offset = 0; nframes > 0; nframes -= nframes_left ) {
+		position = cycle_start + nframes_offset;
+		beat     = 0;
+
+		for( ; event < cycle->nevents && cycle->events[event].offset <= nframes_offset; event++ )
+			process_event(&cycle->events[event], position);
+
+		if( grid_boundary(&quantize_frames, state.snap_delay) ) {
+			trace_instant(TRACE_QUANTIZE, nframes_offset);
+			process_patterns();
+
+			beat = clock_on_boundary();
+		}
+
+		/* volume changes from the events above ramp in from here */
+		for( j = 0; j < group_count; j++ ) {
+			g = &state.groups[j];
+			g->quantize_due = grid_boundary(&g->quantize_frames, g->snap_delay);
+			group_gain_update(g, rate);
+		}
+
+		cycle->commands += process_requests(cycle, REQUESTS_DUE, nframes_offset);
+
+		/* after the requests, so that a loop starting on this beat
+		   gets the clock started with it */
+		if( beat && cycle->want_clock )
+			clock_beat(cycle, nframes_offset);
+
+		/* split at the next boundary of every grid that has something
+		   waiting on it, wherever an unquantized cut lands, at the
+		   next timed event and where a take punches out */
+		nframes_left = nframes;
+
+		if( event < cycle->nevents )
+			nframes_left = MIN(nframes_left, cycle->events[event].offset - nframes_offset);
+
+		if( !list_is_empty(state.patterns) || cycle->want_clock )
+			nframes_left = MIN(nframes_left, state.snap_delay - quantize_frames);
+
+		for( j = 0; j < group_count; j++ ) {
+			g = &state.groups[j];
+
+			if( g->quantize_pending )
+				nframes_left = MIN(nframes_left, g->snap_delay - g->quantize_frames);
+		}
+
+		if( next_target < position + nframes_left )
+			nframes_left = next_target - position;
+
+		nframes_left = capture_block(nframes_left);
+
+		if( cycle->want_clock )
+			clock_block(cycle, nframes_offset, nframes_left);
+
+		period_end = ( nframes_left == nframes );
+		grid_advance(&quantize_frames, state.snap_delay, nframes_left, period_end);
+
+		for( j = 0; j < group_count; j++ ) {
+			g = &state.groups[j];
+			grid_advance(&g->quantize_frames, g->snap_delay, nframes_left, period_end);
+		}
+
+		/* groups a bounce is recording from are recorded at unity, so
+		   that the slot plays back at the group's gain like anything
+		   else.  punching out below doesn't change that for this block. */
+		bounced = capture_groups();
+
+		/* only the voices, none of the rest of the loops */
+		for( j = 0; j < group_count; j++ ) {
+			g = &state.groups[j];
+			g->unity = !!(bounced & (1 << j));
+
+			if( !(v = g->voice) )
+				continue;
+
+			for( k = 0; k < g->channels; k++ )
+				buffers[k] = g->output_buffers[k] + nframes_offset;
+
+			g->silent = 0;
+
+			if( cycle->group_ns ) {
+				t = engine_now_ns();
+				v->process_cb(v, g, buffers, nframes_left, rate);
+				cycle->group_ns[j] += engine_now_ns() - t;
+			} else
+				v->process_cb(v, g, buffers, nframes_left, rate);
+		}
+
+		/* after the groups have played, so a take that punches out
+		   here starts looping with the next block */
+		capture_record(cycle->input, nframes_offset, nframes_left);
+
+		for( j = 0; bounced && j < group_count; j++ ) {
+			g = &state.groups[j];
+
+			/* the take may have stopped the voice, but it's played */
+			if( !g->unity || g->silent )
+				continue;
+
+			for( k = 0; k < g->channels; k++ )
+				buffers[k] = g->output_buffers[k] + nframes_offset;
+
+			group_apply_gain(g, buffers, nframes_left);
+		}
+
+		for( j = 0; j < group_count; j++ )
+			group_gain_advance(&state.groups[j], nframes_left);
+
+		nframes_offset += nframes_left;
+		cycle->blocks++;
+	}
+
+	for( j = 0; j < group_count; j++ ) {
+		if( !(v = state.groups[j].voice) )
+			continue;
+
+		cycle->voices++;
+		cycle->src_voices += uses_src(v, rate);
+	}
+}
@@ -16,6 +16,7 @@
  * along with rove.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -28,9 +29,15 @@
 #endif
 
 #include "types.h"
+#include "capture.h"
+#include "engine.h"
 #include "group.h"
 #include "rmonome.h"
 #include "file.h"
+#include "sample.h"
+#include "trace.h"
+#include "util.h"
+#include "voice.h"
 
 #define FILE_T(x) ((file_t *) x)
 
@@ -66,54 +73,192 @@ static void calculate_monome_pos(sf_count_t length, sf_count_t position, uint_t
 	pos->y = y;
 }
 
-static void file_process(file_t *self, jack_default_audio_sample_t **buffers, int channels, jack_nframes_t nframes, jack_nframes_t sample_rate) {
-	sf_count_t i, o;
+/**
+ * mixes nframes from data, which is interleaved data_channels wide with
+ * stride floats from one frame to the next, into the group's buffers
+ * starting at offset.  the output is done a channel at a time, pairing
+ * channels off as described in group.h.  the gain is gain + step * n on
+ * the nth frame of the ramp, and this block starts at frame at of it,
+ * so the gain comes out the same however the ramp's been split up.
+ */
+static void mix_channels(jack_default_audio_sample_t **buffers, int channels, jack_nframes_t offset,
+                         const float *data, int data_channels, ptrdiff_t stride,
+                         jack_nframes_t nframes, float gain, float step, int at) {
+	jack_default_audio_sample_t *out;
+	const float *in;
+	int i, k, n;
+
+	n = nframes;
+
+	for( k = 0; k < MAX(channels, data_channels); k++ ) {
+		out = buffers[k % channels] + offset;
+		in  = data + k % data_channels;
+
+		for( i = 0; i < n; i++ )
+			out[i] += in[i * stride] * (gain + step * (at + i));
+	}
+}
+
+#ifdef HAVE_SRC
+/* the frame k frames on from the play position, in whichever direction
+   the loop is playing */
+static const float *frame_at(voice_t *self, sf_count_t k) {
+	sf_count_t p;
+
+	if( self->play_direction == FILE_PLAY_DIRECTION_REVERSE )
+		k = -k;
+
+	p = (self->play_offset + k) % self->file_length;
+
+	if( p < 0 )
+		p += self->file_length;
+
+	return self->file_data + p * self->channels;
+}
+
+/* catmull-rom through x0 and x1, t of the way between them */
+static float cubic(float xm, float x0, float x1, float x2, float t) {
+	float c1, c2, c3;
+
+	c1 = (x1 - xm) * 0.5f;
+	c2 = xm - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+	c3 = (x2 - xm) * 0.5f + 1.5f * (x0 - x1);
+
+	return ((c3 * t + c2) * t + c1) * t + x0;
+}
+
+/**
+ * the cheaper rungs of the quality ladder (see quality.h), which walk
+ * through the loop themselves rather than going through libsamplerate.
+ * step is how many of the loop's frames go by per frame of output.
+ */
+static void interpolate(voice_t *self, float *b, jack_nframes_t nframes, double step, int quality) {
+	const float *xm, *x0, *x1, *x2;
+	jack_nframes_t i;
+	sf_count_t n;
+	float t;
+	int c;
+
+	for( i = 0; i < nframes; i++, b += self->channels ) {
+		t  = self->src_phase;
+		x0 = frame_at(self, 0);
+		x1 = frame_at(self, 1);
+
+		if( quality == QUALITY_CUBIC ) {
+			xm = frame_at(self, -1);
+			x2 = frame_at(self, 2);
+
+			for( c = 0; c < self->channels; c++ )
+				b[c] = cubic(xm[c], x0[c], x1[c], x2[c], t);
+		} else
+			for( c = 0; c < self->channels; c++ )
+				b[c] = x0[c] + (x1[c] - x0[c]) * t;
+
+		self->src_phase += step;
+
+		if( (n = (sf_count_t) self->src_phase) ) {
+			self->src_phase -= n;
+			voice_inc_play_pos(self, n);
+		}
+	}
+}
+
+/* the ladder moves every loop at once, each picks it up as it plays */
+static void change_quality(voice_t *self, int quality) {
+	/* libsamplerate has read ahead of the play position, so it gets
+	   started over from there.  the other way, it's left to sit. */
+	if( quality == QUALITY_SINC )
+		src_reset(self->src);
+	else if( self->src_quality == QUALITY_SINC )
+		self->src_phase = 0;
+
+	self->src_quality = quality;
+}
+#endif
+
+static void file_mix(voice_t *self, jack_default_audio_sample_t **buffers, int channels,
+                     jack_nframes_t offset, jack_nframes_t nframes, jack_nframes_t sample_rate,
+                     float gain, float step, int at) {
+	jack_nframes_t n;
+	sf_count_t pos;
 
 #ifdef HAVE_SRC
-	float b[2];
+	float b[FILE_SRC_SCRATCH];
+	jack_nframes_t i;
 	double speed;
+	int quality;
 
 	speed = (sample_rate / (double) self->sample_rate) * (1 / self->speed);
 
 	if( self->speed != 1 || self->sample_rate != sample_rate ) {
-		if( self->channels == 1 ) {
-			for( i = 0; i < nframes; i++ ) {
-				src_callback_read(self->src, speed, 1, b);
-				buffers[0][i] += b[0] * self->volume;
-				buffers[1][i] += b[0] * self->volume;
-			}
-		} else {
-			for( i = 0; i < nframes; i++ ) {
-				src_callback_read(self->src, speed, 1, b);
-				buffers[0][i] += b[0] * self->volume;
-				buffers[1][i] += b[1] * self->volume;
-			}
+		if( (quality = state.quality) != self->src_quality )
+			change_quality(self, quality);
+
+		/* the resampler hands back a frame at a time, so gather up as
+		   many as fit and mix them from there */
+		for( ; nframes; nframes -= n, offset += n ) {
+			n = MIN(nframes, FILE_SRC_SCRATCH / self->channels);
+
+			if( quality == QUALITY_SINC )
+				for( i = 0; i < n; i++ )
+					src_callback_read(self->src, speed, 1, b + i * self->channels);
+			else
+				interpolate(self, b, n, 1 / speed, quality);
+
+			mix_channels(buffers, channels, offset, b, self->channels,
+			             self->channels, n, gain, step, at);
+			at += n;
 		}
-	} else {
+
+		return;
+	}
 #endif
-		if( self->channels == 1 ) {
-			for( i = 0; i < nframes; i++ ) {
-				o = file_get_play_pos(self);
-				buffers[0][i] += self->file_data[o]   * self->volume;
-				buffers[1][i] += self->file_data[o]   * self->volume;
-				file_inc_play_pos(self, 1);
-			}
+
+	/* straight from the file, in runs up to wherever it wraps around */
+	for( ; nframes; nframes -= n, offset += n, at += n ) {
+		pos = self->play_offset;
+
+		if( self->play_direction == FILE_PLAY_DIRECTION_REVERSE ) {
+			n = MIN(nframes, pos + 1);
+			mix_channels(buffers, channels, offset, self->file_data + voice_get_play_pos(self),
+			             self->channels, -self->channels, n, gain, step, at);
 		} else {
-			for( i = 0; i < nframes; i++ ) {
-				o = file_get_play_pos(self);
-				buffers[0][i] += self->file_data[o]   * self->volume;
-				buffers[1][i] += self->file_data[++o] * self->volume;
-				file_inc_play_pos(self, 1);
-			}
+			n = MIN(nframes, self->file_length - pos);
+			mix_channels(buffers, channels, offset, self->file_data + voice_get_play_pos(self),
+			             self->channels, self->channels, n, gain, step, at);
 		}
-#ifdef HAVE_SRC
+
+		voice_inc_play_pos(self, n);
 	}
-#endif
+}
+
+static void file_process(voice_t *self, group_t *g, jack_default_audio_sample_t **buffers, jack_nframes_t nframes, jack_nframes_t sample_rate) {
+	int channels = g->channels;
+	jack_nframes_t ramp;
+
+	/* a group that's being bounced plays at unity, and gets its gain
+	   once the capture has had its copy (see group_apply_gain()) */
+	if( g->unity ) {
+		file_mix(self, buffers, channels, 0, nframes, sample_rate, self->volume, 0, 0);
+		return;
+	}
+
+	/* the group's volume ramp, if it's on one (see group.c), and then
+	   whatever it's ramping to for the rest of the block */
+	ramp = MIN(nframes, g->gain_left);
+
+	if( ramp )
+		file_mix(self, buffers, channels, 0, ramp, sample_rate,
+		         self->volume * g->gain, self->volume * g->gain_step, g->gain_at);
+
+	if( ramp < nframes )
+		file_mix(self, buffers, channels, ramp, nframes - ramp, sample_rate,
+		         self->volume * g->gain_target, 0, 0);
 }
 
 #ifdef HAVE_SRC
 static long file_src_callback(void *cb_data, float **data) {
-	file_t *self = cb_data;
+	voice_t *self = cb_data;
 	sf_count_t o;
 
 	if( !data )
@@ -121,7 +266,7 @@ static long file_src_callback(void *cb_data, float **data) {
 
 	o = self->play_offset;
 	*data = self->file_data + (o * self->channels);
-	file_inc_play_pos(self, 1);
+	voice_inc_play_pos(self, 1);
 
 	return 1;
 }
@@ -137,7 +282,7 @@ static void file_monome_out(file_t *self, r_monome_t *monome) {
 	uint8_t *row = (uint8_t *) &r;
 
 	calculate_monome_pos(
-		self->file_length * self->channels, file_get_play_pos(self),
+		self->voice->file_length * self->voice->channels, voice_get_play_pos(self->voice),
 		self->row_span, (self->columns) ? self->columns : monome->cols, &pos);
 
 	if( MONOME_POS_CMP(&pos, &self->monome_pos_old)
@@ -147,12 +292,12 @@ static void file_monome_out(file_t *self, r_monome_t *monome) {
 			monome->dirty_field &= ~(1 << self->y);
 			self->force_monome_update = 0;
 
-			monome_led_set(monome->dev, self->group->idx, 0,
-			               !!self->group->active_loop);
+			r_monome_led_set(monome, self->group->idx, 0,
+			                 !!self->group->active_loop);
 		}
 
 		if( pos.y != self->monome_pos_old.y ) 
-			monome_led_row(monome->dev, 0, self->y + self->monome_pos_old.y, 2, row);
+			r_monome_led_row(monome, 0, self->y + self->monome_pos_old.y, 2, row);
 
 		MONOME_POS_CPY(&self->monome_pos_old, &pos);
 
@@ -161,14 +306,14 @@ static void file_monome_out(file_t *self, r_monome_t *monome) {
 
 		if( !file_mapped(self) ) {
 			if( random() & 1 && file_is_active(self) )
-				monome_led_set(monome->dev, self->group - state.groups, 0, 1);
+				r_monome_led_set(monome, self->group - state.groups, 0, 1);
 			else {
-				monome_led_set(monome->dev, self->group - state.groups, 0, 0);
+				r_monome_led_set(monome, self->group - state.groups, 0, 0);
 				r = 0;
 			}
 		}
 
-		monome_led_row(monome->dev, 0, self->y + pos.y, 2, row);
+		r_monome_led_row(monome, 0, self->y + pos.y, 2, row);
 	}
 
 	MONOME_POS_CPY(&self->monome_pos, &pos);
@@ -180,6 +325,10 @@ static void file_monome_in(r_monome_t *monome, uint_t x, uint_t y, uint_t type,
 
 	r_monome_position_t pos = {x, y - self->y};
 
+	/* grid presses on a slot have been through capture_grid_in() */
+	if( self->capture && !capture_can_cut(self) )
+		return;
+
 	switch( type ) {
 	case MONOME_BUTTON_DOWN:
 		if( y < self->y || y > ( self->y + self->row_span - 1) )
@@ -190,8 +339,8 @@ static void file_monome_in(r_monome_t *monome, uint_t x, uint_t y, uint_t type,
 			return;
 
 		self->new_offset =
-			calculate_play_pos(self->file_length, pos.x, pos.y,
-		                       (self->play_direction == FILE_PLAY_DIRECTION_REVERSE),
+			calculate_play_pos(self->voice->file_length, pos.x, pos.y,
+		                       (self->voice->play_direction == FILE_PLAY_DIRECTION_REVERSE),
 		                       self->row_span, cols);
 
 		file_on_quantize(self, file_seek);
@@ -203,50 +352,102 @@ static void file_monome_in(r_monome_t *monome, uint_t x, uint_t y, uint_t type,
 }
 
 static void file_init(file_t *self) {
-	self->status         = FILE_STATUS_INACTIVE;
-	self->play_direction = FILE_PLAY_DIRECTION_FORWARD;
-	self->volume         = 1.0;
+	self->status                = FILE_STATUS_INACTIVE;
+	self->voice->play_direction = FILE_PLAY_DIRECTION_FORWARD;
+	self->voice->volume         = 1.0;
 
-	self->process_cb     = file_process;
 	self->monome_out_cb  = file_monome_out;
 	self->monome_in_cb   = file_monome_in;
 }
 
 void file_free(file_t *self) {
-	free(self->file_data);
+	if( !self->file_data_borrowed )
+		sample_free(self->voice->file_data, self->file_data_size);
+
+	if( self->capture )
+		capture_free(self->capture);
+
+#ifdef HAVE_SRC
+	if( self->voice->src )
+		src_delete(self->voice->src);
+#endif
+
+	voice_free(self->voice);
 	free(self);
 }
 
-file_t *file_new_from_path(const char *path) {
+static file_t *file_new(sf_count_t frames, sf_count_t channels, sf_count_t sample_rate) {
 #ifdef HAVE_SRC
 	int err;
 #endif
 	file_t *self;
-	SF_INFO info;
-	SNDFILE *snd;
+	voice_t *v;
 
 	if( !(self = calloc(sizeof(file_t), 1)) )
 		return NULL;
 
+	if( !(v = self->voice = voice_new(file_process)) ) {
+		free(self);
+		return NULL;
+	}
+
 	file_init(self);
 
+	self->length   = v->file_length = frames;
+	v->channels    = channels;
+	v->sample_rate = sample_rate;
+
+#ifdef HAVE_SRC
+	v->src         = src_callback_new(file_src_callback, SRC_SINC_FASTEST, channels, &err, v);
+#endif
+
+	return self;
+}
+
+file_t *file_new_from_buffer(float *data, sf_count_t frames, sf_count_t channels, sf_count_t sample_rate) {
+	file_t *self;
+
+	if( !(self = file_new(frames, channels, sample_rate)) )
+		return NULL;
+
+	self->voice->file_data = data;
+	self->file_data_borrowed = 1;
+
+	return self;
+}
+
+file_t *file_new_from_path(const char *path) {
+	file_t *self;
+	SF_INFO info;
+	SNDFILE *snd;
+
 	if( !(snd = sf_open(path, SFM_READ, &info)) ) {
 		printf("file: couldn't load \"%s\".  sorry about your luck.\n%s\n\n", path, sf_strerror(snd));
+		return NULL;
+	}
 
-		free(self);
+	if( info.channels > FILE_MAX_CHANNELS ) {
+		printf("file: \"%s\" has %d channels, rove can only do %d.\n\n",
+		       path, info.channels, FILE_MAX_CHANNELS);
+		sf_close(snd);
 		return NULL;
 	}
 
-	self->length      = self->file_length = info.frames;
-	self->channels    = info.channels;
-	self->sample_rate = info.samplerate;
-	self->file_data   = calloc(sizeof(float), info.frames * info.channels);
+	if( !(self = file_new(info.frames, info.channels, info.samplerate)) ) {
+		sf_close(snd);
+		return NULL;
+	}
 
-#ifdef HAVE_SRC
-	self->src         = src_callback_new(file_src_callback, SRC_SINC_FASTEST, info.channels, &err, self);
-#endif
+	self->file_data_size = sizeof(float) * info.frames * info.channels;
+
+	if( !(self->voice->file_data = sample_alloc(self->file_data_size)) ) {
+		fprintf(stderr, "file: couldn't allocate memory for \"%s\", aieee!\n", path);
+		file_free(self);
+		sf_close(snd);
+		return NULL;
+	}
 
-	if( sf_readf_float(snd, self->file_data, info.frames) != info.frames ) {
+	if( sf_readf_float(snd, self->voice->file_data, info.frames) != info.frames ) {
 		file_free(self);
 		self = NULL;
 	}
@@ -256,23 +457,6 @@ file_t *file_new_from_path(const char *path) {
 	return self;
 }
 
-void file_set_play_pos(file_t *self, sf_count_t p) {
-	if( p >= self->file_length )
-		p %= self->file_length;
-
-	if( p < 0 )
-		p = self->file_length - (abs(p) % self->file_length);
-
-	self->play_offset = p;
-}
-
-void file_inc_play_pos(file_t *self, sf_count_t delta) {
-	if( self->play_direction == FILE_PLAY_DIRECTION_REVERSE )
-		file_set_play_pos(self, self->play_offset - delta);
-	else
-		file_set_play_pos(self, self->play_offset + delta);
-}
-
 void file_change_status(file_t *self, file_status_t nstatus) {
 	switch(self->status) {
 	case FILE_STATUS_ACTIVE:
@@ -281,8 +465,10 @@ void file_change_status(file_t *self, file_status_t nstatus) {
 			return;
 
 		case FILE_STATUS_INACTIVE:
-			if( self->group->active_loop == self )
+			if( self->group->active_loop == self ) {
 				self->group->active_loop = NULL;
+				self->group->voice = NULL;
+			}
 
 			break;
 		}
@@ -313,20 +499,40 @@ void file_deactivate(file_t *self) {
 }
 
 void file_seek(file_t *self) {
+	trace_instant(TRACE_SEEK, self->y);
 	file_change_status(self, FILE_STATUS_ACTIVE);
-	file_set_play_pos(self, self->new_offset);
+	voice_set_play_pos(self->voice, self->new_offset);
 }
 
-void file_on_quantize(file_t *self, quantize_callback_t cb) {
-	if( cb )
+static void file_request(file_t *self, quantize_callback_t cb, int immediate) {
+	if( cb ) {
+		self->quantize_frame     = engine_request_frame();
+		self->quantize_event     = engine_request_event();
+		self->quantize_arrival   = engine_request_arrival();
+		self->quantize_seen      = ENGINE_NOT_SEEN;
+		self->quantize_immediate = immediate;
+		self->quantize_target    = ( !immediate && self->group->unquantized )
+			? engine_request_target() : ENGINE_NO_TARGET;
 		self->mapped_monome->quantize_field |= 1 << self->y;
-	else
+	} else
 		self->mapped_monome->quantize_field &= ~(1 << self->y);
 
-	self->quantize_cb = cb;
+	/* the engine reads quantize_cb first, so everything above has to
+	   be visible by the time it sees the new callback. */
+	__atomic_store_n(&self->quantize_cb, cb, __ATOMIC_RELEASE);
+	r_monome_wake_display(self->mapped_monome);
+}
+
+void file_on_quantize(file_t *self, quantize_callback_t cb) {
+	file_request(self, cb, 0);
+}
+
+void file_on_cycle(file_t *self, quantize_callback_t cb) {
+	file_request(self, cb, 1);
 }
 
 void file_force_monome_update(file_t *self) {
 	self->force_monome_update = 1;
 	self->mapped_monome->dirty_field |= 1 << self->y;
+	r_monome_wake_display(self->mapped_monome);
 }
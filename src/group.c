@@ -16,8 +16,13 @@
  * along with rove.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <math.h>
+
 #include "types.h"
 #include "file.h"
+#include "group.h"
+#include "util.h"
 
 void group_activate_file(file_t *file) {
 	if( file->group->active_loop
@@ -26,4 +31,99 @@ void group_activate_file(file_t *file) {
 		file_deactivate(file->group->active_loop);
 
 	file->group->active_loop = file;
+	file->group->voice = file->voice;
+}
+
+group_t *group_array_new(uint_t group_count) {
+	group_t *groups;
+	int i;
+
+	if( !(groups = calloc(sizeof(group_t), group_count)) )
+		return NULL;
+
+	for( i = 0; i < group_count; i++ ) {
+		groups[i].idx      = i;
+		groups[i].channels = 2;
+		groups[i].volume   = groups[i].gain_target = 1.0;
+		groups[i].gain     = 1.0;
+	}
+
+	return groups;
+}
+
+void group_set_volume(group_t *self, double volume) {
+	__atomic_store(&self->volume, &volume, __ATOMIC_RELAXED);
+}
+
+/**
+ * volume changes don't jump: at the start of each block the engine picks
+ * up a new volume and sets the gain off towards it in a straight line,
+ * which file_process() folds into its mixing loop.  the gain on each
+ * frame is worked out from where the ramp started rather than added up
+ * as it goes, so it doesn't matter how the period gets split.  a change
+ * in the middle of a ramp starts a new one from wherever the gain has
+ * got to.
+ */
+
+void group_gain_update(group_t *self, jack_nframes_t sample_rate) {
+	double volume;
+
+	__atomic_load(&self->volume, &volume, __ATOMIC_RELAXED);
+
+	if( volume == self->gain_target )
+		return;
+
+	if( self->gain_left )
+		self->gain += self->gain_step * self->gain_at;
+
+	self->gain_target = volume;
+	self->gain_at     = 0;
+	self->gain_left   = MAX(lrint(GROUP_GAIN_RAMP * sample_rate), 1);
+	self->gain_step   = (volume - self->gain) / self->gain_left;
+}
+
+/**
+ * scales what a group played at unity by the gain file_process() would
+ * have used, worked out the same way, so that the result is the same as
+ * if it had played at the group's gain in the first place.
+ */
+void group_apply_gain(group_t *self, jack_default_audio_sample_t **buffers, jack_nframes_t nframes) {
+	jack_default_audio_sample_t *out;
+	float gain, step, target;
+	int i, k, n, ramp, at;
+
+	gain   = self->gain;
+	step   = self->gain_step;
+	target = self->gain_target;
+
+	n    = nframes;
+	ramp = MIN(nframes, self->gain_left);
+	at   = self->gain_at;
+
+	for( k = 0; k < self->channels; k++ ) {
+		out = buffers[k];
+
+		for( i = 0; i < ramp; i++ )
+			out[i] *= gain + step * (at + i);
+
+		for( ; i < n; i++ )
+			out[i] *= target;
+	}
+}
+
+void group_gain_advance(group_t *self, jack_nframes_t nframes) {
+	if( !self->gain_left )
+		return;
+
+	if( nframes >= self->gain_left ) {
+		/* land right on it, whatever rounding the steps picked up */
+		self->gain      = self->gain_target;
+		self->gain_step = 0;
+		self->gain_at   = 0;
+		self->gain_left = 0;
+		return;
+	}
+
+	self->gain_at   += nframes;
+	self->gain_left -= nframes;
 }
@@ -0,0 +1,104 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+static int bucket(uint64_t v) {
+	int octave;
+
+	if( v < HISTOGRAM_STEPS )
+		return v;
+
+	if( (octave = 63 - __builtin_clzll(v)) >= HISTOGRAM_OCTAVES )
+		return HISTOGRAM_BUCKETS - 1;
+
+	/* the two bits under the leading one pick the step */
+	return octave * HISTOGRAM_STEPS + ((v >> (octave - 2)) & (HISTOGRAM_STEPS - 1));
+}
+
+static uint64_t bucket_ceiling(int b) {
+	int octave = b / HISTOGRAM_STEPS, step = b % HISTOGRAM_STEPS;
+
+	if( octave < 2 )
+		return b + 1;
+
+	return ((uint64_t) (HISTOGRAM_STEPS + step + 1)) << (octave - 2);
+}
+
+void histogram_add(histogram_t *self, uint64_t value) {
+	uint64_t max;
+
+	__atomic_fetch_add(&self->buckets[bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&self->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&self->sum, value, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&self->max, __ATOMIC_RELAXED);
+	while( value > max && !__atomic_compare_exchange_n(&self->max, &max, value, 1,
+	                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+}
+
+void histogram_copy(histogram_t *self, histogram_t *into) {
+	int i;
+
+	for( i = 0; i < HISTOGRAM_BUCKETS; i++ )
+		into->buckets[i] = __atomic_load_n(&self->buckets[i], __ATOMIC_RELAXED);
+
+	into->count = __atomic_load_n(&self->count, __ATOMIC_RELAXED);
+	into->sum   = __atomic_load_n(&self->sum, __ATOMIC_RELAXED);
+	into->max   = __atomic_load_n(&self->max, __ATOMIC_RELAXED);
+}
+
+void histogram_take(histogram_t *self, histogram_t *into) {
+	int i;
+
+	for( i = 0; i < HISTOGRAM_BUCKETS; i++ )
+		into->buckets[i] = __atomic_exchange_n(&self->buckets[i], 0, __ATOMIC_RELAXED);
+
+	into->count = __atomic_exchange_n(&self->count, 0, __ATOMIC_RELAXED);
+	into->sum   = __atomic_exchange_n(&self->sum, 0, __ATOMIC_RELAXED);
+	into->max   = __atomic_exchange_n(&self->max, 0, __ATOMIC_RELAXED);
+}
+
+uint64_t histogram_quantile(const histogram_t *self, double q) {
+	uint64_t total, seen;
+	int i;
+
+	/* count from the buckets rather than self->count, which might be
+	   a little ahead of them if the copy raced an add */
+	for( i = 0, total = 0; i < HISTOGRAM_BUCKETS; i++ )
+		total += self->buckets[i];
+
+	if( !total )
+		return 0;
+
+	for( i = 0, seen = 0; i < HISTOGRAM_BUCKETS; i++ ) {
+		seen += self->buckets[i];
+
+		if( seen >= q * total )
+			break;
+	}
+
+	/* never claim more than we've actually seen */
+	if( i == HISTOGRAM_BUCKETS || (self->max && bucket_ceiling(i) > self->max) )
+		return self->max;
+
+	return bucket_ceiling(i);
+}
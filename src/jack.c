@@ -16,20 +16,27 @@
  * along with rove.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <pthread.h>
-#include <sndfile.h>
+#include <semaphore.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
+#include <time.h>
 
 #include <jack/jack.h>
 
-#include "file.h"
+#include "engine.h"
 #include "jack.h"
-#include "list.h"
-#include "util.h"
+#include "latency.h"
+#include "midi.h"
+#include "quality.h"
+#include "recorder.h"
 #include "rmonome.h"
-#include "pattern.h"
+#include "rtcheck.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
+#include "util.h"
+#include "xrun.h"
 
 extern state_t state;
 
@@ -39,118 +46,181 @@ static jack_port_t *group_mix_inport_r;
 static jack_port_t *outport_l;
 static jack_port_t *outport_r;
 
-static void process_file(file_t *f) {
-	if( !f )
-		return;
+static jack_port_t *capture_inport_l;
+static jack_port_t *capture_inport_r;
 
-	if( f->quantize_cb ) {
-		f->quantize_cb(f);
-		file_on_quantize(f, NULL);
-	}
-}
+static jack_port_t *midi_inport;
+static jack_port_t *midi_clock_outport;
+static engine_event_t midi_events[MIDI_MAX_EVENTS];
 
-static void process_patterns() {
-	list_member_t *m;
+/**
+ * with --freewheel, a timeline is played into the engine from inside
+ * process() and the master mix goes through the recorder, while JACK
+ * runs us as fast as it can.  nothing happens until freewheeling has
+ * actually started, so the engine's first frame is the render's.
+ */
 
-	list_foreach_raw(state.patterns, m)
-		pattern_process(PATTERN_T(m));
+static timeline_t *render_tl = NULL;
+static const timeline_event_t *render_event;
+static uint64_t render_end;
+static int render_done;
+static sem_t render_sem;
+
+static void silence(jack_port_t *port, jack_nframes_t nframes) {
+	memset(jack_port_get_buffer(port, nframes), 0, sizeof(jack_default_audio_sample_t) * nframes);
 }
 
-static int process(jack_nframes_t nframes, void *arg) {
-	static int quantize_frames = 0;
+static int render_idle(jack_nframes_t nframes) {
+	int i, k;
 
-#define on_quantize_boundary() (!quantize_frames)
+	if( __atomic_load_n(&state.freewheeling, __ATOMIC_ACQUIRE) && !render_done )
+		return 0;
 
-	jack_default_audio_sample_t *out_l;
-	jack_default_audio_sample_t *out_r;
-	jack_default_audio_sample_t *in_l;
-	jack_default_audio_sample_t *in_r;
+	silence(outport_l, nframes);
+	silence(outport_r, nframes);
 
-	jack_nframes_t until_quantize, rate, nframes_left, nframes_offset, i;
-	int j, group_count, next_bit;
-	uint16_t qfield;
+	for( i = 0; i < state.group_count; i++ )
+		for( k = 0; k < state.groups[i].channels; k++ )
+			silence(state.groups[i].outports[k], nframes);
 
-	jack_default_audio_sample_t *buffers[2];
+	return 1;
+}
 
-	group_t *g;
-	file_t *f;
+/* the timeline's MIDI takes the place of midi_in's */
+static int render_input(uint64_t start, jack_nframes_t nframes) {
+	const timeline_event_t *e;
+	int n = 0;
 
-	group_count = state.group_count;
+	for( e = render_event; e < render_tl->events + render_tl->count && e->frame < start + nframes; e++ ) {
+		if( timeline_is_midi(e) ) {
+			if( n < MIDI_MAX_EVENTS )
+				timeline_engine_event(e, start, &midi_events[n++]);
 
-	rate = jack_get_sample_rate(state.client);
+			continue;
+		}
 
-	/* initialize each group's output buffers and zero them */
-	for( i = 0; i < group_count; i++ ) {
-		g = &state.groups[i];
+		engine_input_at(e->frame, e->target);
+		r_monome_handle_event(state.monome, e->x, e->y, e->type);
+	}
 
-		g->output_buffer_l = out_l = jack_port_get_buffer(g->outport_l, nframes);
-		g->output_buffer_r = out_r = jack_port_get_buffer(g->outport_r, nframes);
+	render_event = e;
+	return n;
+}
 
-		for( j = 0; j < nframes; j++ )
-			out_l[j] = out_r[j] = 0;
+static void render_output(const jack_default_audio_sample_t *l, const jack_default_audio_sample_t *r,
+                          uint64_t start, jack_nframes_t nframes) {
+	if( start + nframes < render_end ) {
+		recorder_process(l, r, nframes);
+		return;
 	}
 
-	for( nframes_offset = 0; nframes > 0; nframes -= nframes_left ) {
-		if( on_quantize_boundary() ) {
-			process_patterns();
+	recorder_process(l, r, render_end - start);
+	render_done = 1;
+	sem_post(&render_sem);
+}
+
+static int process(jack_nframes_t nframes, void *arg) {
+	jack_default_audio_sample_t *out_l;
+	jack_default_audio_sample_t *out_r;
+	jack_default_audio_sample_t *in_l;
+	jack_default_audio_sample_t *in_r;
+	jack_default_audio_sample_t *buf;
+
+	engine_cycle_t cycle;
+	uint64_t t, start;
+	group_t *g;
+	int i, k, nevents;
+
+	start   = engine_next_frame();
+	nevents = 0;
 
-			for( j = 0; j < group_count; j++ ) {
-				g = &state.groups[j];
-				f = g->active_loop;
+	/* grid events from a timeline go in the way offline.c does it,
+	   outside of what rtcheck looks at */
+	if( render_tl ) {
+		if( render_idle(nframes) )
+			return 0;
 
-				process_file(f);
-			}
+		nevents = render_input(start, nframes);
+	}
 
-			qfield = state.monome->quantize_field >> 1;
+	rtcheck_enter();
+	t = engine_now_ns();
+
+	trace_thread("audio");
+	trace_begin(TRACE_PROCESS, nframes);
+
+	cycle.nframes    = nframes;
+	cycle.rate       = state.sample_rate;
+	cycle.group_ns   = NULL;
+	cycle.clock_us   = ( state.freewheeling ) ? 0
+		: jack_frames_to_time(state.client, jack_last_frame_time(state.client));
+	cycle.events     = midi_events;
+	cycle.nevents    = ( render_tl ) ? nevents
+		: midi_read(jack_port_get_buffer(midi_inport, nframes), midi_events, MIDI_MAX_EVENTS);
+	/* splitting the period on every beat for a clock nobody's listening
+	   to would be a waste */
+	cycle.want_clock = ( jack_port_connected(midi_clock_outport) > 0 );
+	cycle.input[0]   = jack_port_get_buffer(capture_inport_l, nframes);
+	cycle.input[1]   = jack_port_get_buffer(capture_inport_r, nframes);
+
+	/* an output port's buffer is ours and keeps what we left in it, so
+	   a group that was silent last cycle still is, as long as JACK hands
+	   us the same buffer */
+	for( i = 0; i < state.group_count; i++ ) {
+		g = &state.groups[i];
 
-			for( j = 0; qfield; qfield >>= next_bit ) {
-				next_bit = ffs(qfield);
-				j += next_bit;
+		for( k = 0; k < g->channels; k++ ) {
+			buf = jack_port_get_buffer(g->outports[k], nframes);
 
-				f = (file_t *) state.monome->callbacks[j].data;
-				process_file(f);
+			if( buf != g->output_buffers[k] ) {
+				g->output_buffers[k] = buf;
+				g->silent = 0;
 			}
 		}
+	}
 
-		until_quantize   = ( quantize_frames > state.snap_delay )
-			? 0 : (state.snap_delay - quantize_frames);
-		nframes_left     = MIN(until_quantize, nframes);
-		quantize_frames += nframes_left;
+	engine_process(&cycle);
 
-		if( quantize_frames >= state.snap_delay - 1 )
-			quantize_frames = 0;
+	if( !render_tl )
+		timeline_log_midi(&cycle);
 
-		for( j = 0; j < group_count; j++ ) {
-			g = &state.groups[j];
+	midi_write_clock(jack_port_get_buffer(midi_clock_outport, nframes), &cycle);
 
-			if( !(f = g->active_loop) )
-				continue;
+	out_l = jack_port_get_buffer(outport_l, nframes);
+	out_r = jack_port_get_buffer(outport_r, nframes);
+	in_l = jack_port_get_buffer(group_mix_inport_l, nframes);
+	in_r = jack_port_get_buffer(group_mix_inport_r, nframes);
 
-			if( !file_is_active(f) )
-				continue;
+	memcpy(out_l, in_l, sizeof(jack_default_audio_sample_t) * nframes);
+	memcpy(out_r, in_r, sizeof(jack_default_audio_sample_t) * nframes);
 
-			/* will eventually become an array of arbitrary size for better multichannel support */
-			buffers[0] = g->output_buffer_l + nframes_offset;
-			buffers[1] = g->output_buffer_r + nframes_offset;
+	if( render_tl )
+		render_output(in_l, in_r, start, nframes);
+	else
+		recorder_process(in_l, in_r, nframes);
 
-			if( f->process_cb )
-				f->process_cb(f, buffers, 2, nframes_left, rate);
-		}
+	t = engine_now_ns() - t;
+	quality_cycle(t, nframes, state.sample_rate);
+	latency_cycle(&cycle, engine_time_us());
+	stats_cycle(&cycle, t);
+	xrun_cycle(&cycle, t);
+	trace_end(TRACE_PROCESS, nframes);
+	rtcheck_leave();
 
-		nframes_offset += nframes_left;
-	}
-
-	out_l = jack_port_get_buffer(outport_l, nframes_offset);
-	out_r = jack_port_get_buffer(outport_r, nframes_offset);
-	in_l = jack_port_get_buffer(group_mix_inport_l, nframes_offset);
-	in_r = jack_port_get_buffer(group_mix_inport_r, nframes_offset);
+	return 0;
+}
 
-	memcpy(out_l, in_l, sizeof(jack_default_audio_sample_t) * nframes_offset);
-	memcpy(out_r, in_r, sizeof(jack_default_audio_sample_t) * nframes_offset);
+static int xrun(void *arg) {
+	stats_xrun();
+	xrun_snapshot();
 
 	return 0;
 }
 
+static void freewheel(int starting, void *arg) {
+	__atomic_store_n(&state.freewheeling, starting, __ATOMIC_RELEASE);
+}
+
 static void jack_shutdown(void *arg) {
 	exit(0);
 }
@@ -182,7 +252,7 @@ void r_jack_deactivate() {
 
 int r_jack_activate() {
 	jack_client_t *client = state.client;
-	int i, group_count;
+	int i, k, group_count;
 	group_t *g;
 
 	if( jack_activate(client) ) {
@@ -192,12 +262,14 @@ int r_jack_activate() {
 
 	connect_to_outports(client);
 
+	/* the groups' channels pair off with the mix's two (see group.h) */
 	group_count = state.group_count;
 	for( i = 0; i < group_count; i++ ) {
 		g = &state.groups[i];
 
-		jack_connect(client, jack_port_name(g->outport_l), jack_port_name(group_mix_inport_l));
-		jack_connect(client, jack_port_name(g->outport_r), jack_port_name(group_mix_inport_r));
+		for( k = 0; k < MAX(g->channels, 2); k++ )
+			jack_connect(client, jack_port_name(g->outports[k % g->channels]),
+			             jack_port_name(( k % 2 ) ? group_mix_inport_r : group_mix_inport_l));
 	}
 
 	return 0;
@@ -209,7 +281,7 @@ int r_jack_init() {
 	jack_options_t options  = JackNoStartServer;
 	jack_status_t status;
 
-	int i, group_count, len;
+	int i, k, group_count, len;
 	group_t *g;
 	char *buf;
 
@@ -219,7 +291,11 @@ int r_jack_init() {
 		return -1;
 	}
 
+	state.sample_rate = jack_get_sample_rate(state.client);
+
 	jack_set_process_callback(state.client, process, NULL);
+	jack_set_xrun_callback(state.client, xrun, NULL);
+	jack_set_freewheel_callback(state.client, freewheel, NULL);
 	jack_on_shutdown(state.client, jack_shutdown, 0);
 
 	outport_l = jack_port_register(state.client, "master_out:l", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
@@ -228,17 +304,87 @@ int r_jack_init() {
 	group_mix_inport_l = jack_port_register(state.client, "group_mix_in:l", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
 	group_mix_inport_r = jack_port_register(state.client, "group_mix_in:r", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
 
+	capture_inport_l = jack_port_register(state.client, "capture_in:l", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+	capture_inport_r = jack_port_register(state.client, "capture_in:r", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+
+	midi_inport = jack_port_register(state.client, "midi_in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+	midi_clock_outport = jack_port_register(state.client, "midi_clock_out", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+
 	group_count = state.group_count;
 	for( i = 0; i < group_count; i++ ) {
 		g = &state.groups[i];
 
-		len = asprintf(&buf, "group_%d_out:l", g->idx + 1);
-		g->outport_l = jack_port_register(state.client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		/* stereo groups keep their l and r, anything else is numbered */
+		for( k = 0; k < g->channels; k++ ) {
+			if( g->channels == 2 )
+				len = asprintf(&buf, "group_%d_out:%c", g->idx + 1, "lr"[k]);
+			else
+				len = asprintf(&buf, "group_%d_out:%d", g->idx + 1, k + 1);
 
-		buf[len - 1]  = 'r';
-		g->outport_r = jack_port_register(state.client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-		free(buf);
+			if( len < 0 ) {
+				fprintf(stderr, "couldn't allocate port name, aieee!\n");
+				return -1;
+			}
+
+			g->outports[k] = jack_port_register(state.client, buf, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+			free(buf);
+		}
 	}
 
 	return 0;
 }
+
+int r_jack_render(const char *timeline_path, const char *output_path) {
+	jack_nframes_t period;
+	uint64_t t;
+	double secs;
+
+	if( !(render_tl = timeline_load(timeline_path)) )
+		return 1;
+
+	period = jack_get_buffer_size(state.client);
+
+	if( render_tl->rate && render_tl->rate != state.sample_rate )
+		printf("freewheel: %s was recorded at %u Hz but JACK is running at %u Hz,\n"
+		       "           so it won't sound the way it did.\n",
+		       timeline_path, render_tl->rate, state.sample_rate);
+	else if( render_tl->period && render_tl->period != period )
+		printf("freewheel: %s was recorded with a period of %u but JACK's is %u,\n"
+		       "           so the render might not match it bit for bit.\n",
+		       timeline_path, render_tl->period, period);
+
+	render_event = render_tl->events;
+	render_end   = timeline_end(render_tl, state.sample_rate);
+	render_done  = 0;
+	sem_init(&render_sem, 0, 0);
+
+	if( r_monome_init_offline() || recorder_start(output_path, state.sample_rate) )
+		return 1;
+
+	if( r_jack_activate() )
+		return 1;
+
+	t = engine_now_ns();
+
+	if( jack_set_freewheel(state.client, 1) ) {
+		fprintf(stderr, "freewheel: JACK wouldn't start freewheeling\n");
+		r_jack_deactivate();
+		recorder_stop();
+		return 1;
+	}
+
+	while( sem_wait(&render_sem) );
+
+	t = engine_now_ns() - t;
+
+	jack_set_freewheel(state.client, 0);
+	r_jack_deactivate();
+	recorder_stop();
+
+	secs = render_end / (double) state.sample_rate;
+	printf("\nfreewheel: rendered %.2f s in %.2f s (%.0fx realtime)\n",
+	       secs, t / 1e9, secs / (t / 1e9));
+
+	timeline_free(render_tl);
+	return 0;
+}
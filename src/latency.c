@@ -0,0 +1,105 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "histogram.h"
+#include "latency.h"
+
+typedef enum {
+	LATENCY_INPUT,
+	LATENCY_QUEUE,
+	LATENCY_QUANTIZE,
+	LATENCY_OVERHEAD,
+	LATENCY_TOTAL,
+
+	LATENCY_COMPONENTS
+} latency_component_t;
+
+static const char *component_names[] = {
+	[LATENCY_INPUT]    = "input",
+	[LATENCY_QUEUE]    = "queue",
+	[LATENCY_QUANTIZE] = "quantize",
+	[LATENCY_OVERHEAD] = "overhead",
+	[LATENCY_TOTAL]    = "total"
+};
+
+static const double quantiles[] = {0.5, 0.9, 0.99};
+
+static histogram_t histograms[LATENCY_COMPONENTS];
+
+static uint64_t since(uint64_t from, uint64_t to) {
+	/* clocks being clocks, "before" can come out slightly after */
+	return ( to > from ) ? to - from : 0;
+}
+
+void latency_input(uint64_t us) {
+	histogram_add(&histograms[LATENCY_INPUT], us);
+}
+
+void latency_cycle(const engine_cycle_t *cycle, uint64_t end_us) {
+	uint64_t quantize, seen_us, total;
+	const engine_fired_t *f;
+	int i;
+
+	for( i = 0; i < cycle->nfired; i++ ) {
+		f = &cycle->fired[i];
+
+		/* frames between the first cycle that could act on the event
+		   and the point it took effect are the quantize grid's doing */
+		quantize = since(f->seen_frame, f->frame) * 1000000 / cycle->rate;
+
+		/* assume the cycles in between ran on schedule to work out
+		   when that first cycle started */
+		seen_us = cycle->start_us - since(f->seen_frame, cycle->start_frame) * 1000000 / cycle->rate;
+		total   = since(f->arrival_us, end_us);
+
+		histogram_add(&histograms[LATENCY_QUEUE], since(f->arrival_us, seen_us));
+		histogram_add(&histograms[LATENCY_QUANTIZE], quantize);
+		histogram_add(&histograms[LATENCY_OVERHEAD], since(quantize, total));
+		histogram_add(&histograms[LATENCY_TOTAL], total);
+	}
+}
+
+void latency_write(FILE *f) {
+	histogram_t h;
+	int i, q;
+
+	fprintf(f, "# HELP rove_latency_seconds button press to audio, by component (since startup)\n"
+	           "# TYPE rove_latency_seconds summary\n");
+
+	for( i = 0; i < LATENCY_COMPONENTS; i++ ) {
+		histogram_copy(&histograms[i], &h);
+
+		for( q = 0; q < sizeof(quantiles) / sizeof(*quantiles); q++ )
+			fprintf(f, "rove_latency_seconds{component=\"%s\",quantile=\"%g\"} %.6f\n",
+			        component_names[i], quantiles[q], histogram_quantile(&h, quantiles[q]) / 1e6);
+
+		fprintf(f, "rove_latency_seconds_sum{component=\"%s\"} %.6f\n", component_names[i], h.sum / 1e6);
+		fprintf(f, "rove_latency_seconds_count{component=\"%s\"} %" PRIu64 "\n", component_names[i], h.count);
+	}
+
+	fprintf(f, "# HELP rove_latency_max_seconds worst button press to audio, by component (since startup)\n"
+	           "# TYPE rove_latency_max_seconds gauge\n");
+
+	for( i = 0; i < LATENCY_COMPONENTS; i++ )
+		fprintf(f, "rove_latency_max_seconds{component=\"%s\"} %.6f\n",
+		        component_names[i], __atomic_load_n(&histograms[i].max, __ATOMIC_RELAXED) / 1e6);
+}
@@ -111,7 +111,7 @@ list_member_t *list_insert(void *data, list_local_location_t l, list_member_t *r
 }
 
 list_member_t *list_pop_raw(list_t *self, list_global_location_t l) {
-	list_member_t *m;
+	list_member_t *m = NULL;
 
 	assert(self);
 
@@ -0,0 +1,114 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+#include "engine.h"
+#include "midi.h"
+#include "rmonome.h"
+
+#define MIDI_NOTE_ON        0x90
+#define MIDI_CONTROL_CHANGE 0xB0
+
+#define MIDI_CLOCK          0xF8
+#define MIDI_START          0xFA
+#define MIDI_STOP           0xFC
+
+extern state_t state;
+
+/**
+ * turns a period's worth of a JACK MIDI port into engine events.  notes
+ * count along the grid from the configured note, starting at row 1
+ * (row 0 is the control row): with eight columns, note 36 cuts row 1
+ * at column 0, 37 cuts column 1, 44 cuts row 2 at column 0 and so on.
+ * controllers from the configured cc up set each group's volume.  note
+ * offs are ignored, same as button releases.
+ */
+
+int midi_read(void *port_buffer, engine_event_t *events, int max) {
+	jack_midi_event_t ev;
+	uint32_t i, count;
+	int n, note, cols;
+	engine_event_t *e;
+
+	count = jack_midi_get_event_count(port_buffer);
+	cols  = ( state.config.midi.columns ) ? state.config.midi.columns : state.monome->cols;
+
+	for( i = n = 0; i < count && n < max; i++ ) {
+		if( jack_midi_event_get(&ev, port_buffer, i) || ev.size < 3 )
+			continue;
+
+		if( state.config.midi.channel
+		    && (ev.buffer[0] & 0x0F) + 1 != state.config.midi.channel )
+			continue;
+
+		e = &events[n];
+		e->offset = ev.time;
+
+		switch( ev.buffer[0] & 0xF0 ) {
+		case MIDI_NOTE_ON:
+			/* a note on with no velocity is a note off */
+			if( !ev.buffer[2] || (note = ev.buffer[1] - state.config.midi.note) < 0 )
+				continue;
+
+			e->type = ENGINE_EVENT_CUT;
+			e->x    = note % cols;
+			e->y    = note / cols + 1;
+			break;
+
+		case MIDI_CONTROL_CHANGE:
+			if( !state.config.midi.cc
+			    || ev.buffer[1] < state.config.midi.cc
+			    || ev.buffer[1] >= state.config.midi.cc + state.group_count )
+				continue;
+
+			e->type  = ENGINE_EVENT_VOLUME;
+			e->y     = ev.buffer[1] - state.config.midi.cc;
+			e->value = ev.buffer[2] / 127.0;
+			break;
+
+		default:
+			continue;
+		}
+
+		n++;
+	}
+
+	return n;
+}
+
+void midi_write_clock(void *port_buffer, const engine_cycle_t *cycle) {
+	jack_midi_data_t msg;
+	int i;
+
+	jack_midi_clear_buffer(port_buffer);
+
+	for( i = 0; i < cycle->nclock; i++ ) {
+		switch( cycle->clock[i].type ) {
+		case ENGINE_CLOCK_TICK:  msg = MIDI_CLOCK; break;
+		case ENGINE_CLOCK_START: msg = MIDI_START; break;
+		case ENGINE_CLOCK_STOP:  msg = MIDI_STOP;  break;
+		default: continue;
+		}
+
+		jack_midi_event_write(port_buffer, cycle->clock[i].offset, &msg, 1);
+	}
+}
@@ -27,13 +27,20 @@
 #include <sndfile.h>
 
 #include "rove.h"
+#include "engine.h"
 #include "file.h"
+#include "group.h"
 #include "jack.h"
 #include "list.h"
 #include "util.h"
 #include "rmonome.h"
+#include "capture.h"
 #include "session.h"
 #include "pattern.h"
+#include "stats.h"
+#include "threads.h"
+#include "trace.h"
+#include "timeline.h"
 
 #define SHIFT 0x01
 #define META  0x02
@@ -42,62 +49,26 @@ extern state_t state;
 
 static void initialize_file_callbacks(r_monome_t *monome);
 
-static int remove_pattern(pattern_t *p, r_monome_t *monome, uint_t x, uint_t y) {
-	pattern_status_set(p, PATTERN_STATUS_INACTIVE);
-	list_remove_raw(LIST_MEMBER_T(p));
-	pattern_free(p);
-
-	monome_led_off(monome->dev, x, y);
-	return 1;
-}
-
-static int finalize_pattern(pattern_t *p, r_monome_t *monome, uint_t x, uint_t y) {
-	if( !stlist_is_empty(p->steps) ) {
-		pattern_status_set(p, PATTERN_STATUS_ACTIVE);
-		monome_led_on(monome->dev, x, y);
-		return 0;
-	}
-
-	return remove_pattern(p, monome, x, y);
-}
-
 static void pattern_handler(r_monome_t *monome, uint_t x, uint_t y, uint_t event_type, void *user_arg) {
-	pattern_t **pptr = ((pattern_t **) &HANDLER_T(user_arg)->data),
-			  *pattern = *pptr;
-	int pat_idx = 4 - monome->cols + x;
+	r_monome_handler_t *button = HANDLER_T(user_arg);
+	pattern_t *pattern;
 
 	if( event_type != MONOME_BUTTON_DOWN )
 		return;
 
-	if( !pattern ) {
-		if( state.pattern_rec )
-			finalize_pattern(state.pattern_rec, monome, x, y);
+	/* holding an empty row down bounces the pattern into it */
+	if( monome->held_row
+	    && (pattern = __atomic_load_n(&button->data, __ATOMIC_ACQUIRE))
+	    && __atomic_load_n(&pattern->status, __ATOMIC_ACQUIRE) == PATTERN_STATUS_ACTIVE
+	    && !__atomic_load_n(&pattern->bounce, __ATOMIC_ACQUIRE) ) {
+		if( !capture_bounce(pattern, monome->held_row) )
+			initialize_file_callbacks(monome);
 
-		pattern = *pptr = pattern_new();
-		pattern->idx    = pat_idx;
-		pattern->monome = monome;
-		pattern->status = PATTERN_STATUS_RECORDING;
-
-		if( state.pattern_lengths[pat_idx] )
-			pattern->step_delay = rintf(floor(
-					state.pattern_lengths[pat_idx] / state.beat_multiplier));
-		else
-			pattern->step_delay = 0;
-
-		list_push_raw(state.patterns, TAIL, LIST_MEMBER_T(pattern));
-		state.pattern_rec = pattern;
-
-		monome_led_on(monome->dev, x, y);
 		return;
 	}
 
-	if( pattern->status == PATTERN_STATUS_RECORDING ) {
-		if( finalize_pattern(pattern, monome, x, y) )
-			*pptr = NULL;
-	} else {
-		remove_pattern(pattern, monome, x, y);
-		*pptr = NULL;
-	}
+	/* the engine starts, finishes or stops it */
+	pattern_press(monome, button, 4 - monome->cols + x);
 }
 
 static void group_off_handler(r_monome_t *monome, uint_t x, uint_t y, uint_t event_type, void *user_arg) {
@@ -111,17 +82,20 @@ static void group_off_handler(r_monome_t *monome, uint_t x, uint_t y, uint_t eve
 		|| !file_is_active(f) )       /* group is already off (active file not playing) */
 		return;
 
-	file_deactivate(f);
+	/* the engine turns it off at the start of its next cycle */
+	file_on_cycle(f, file_deactivate);
+}
 
-	if( f->monome_out_cb )
-		f->monome_out_cb(f, state.monome);
+static void volume_command(void *arg, void *data, double value) {
+	if( !capture_locked(arg) )
+		group_set_volume(arg, value);
 }
 
 static void session_lights(r_monome_t *monome) {
-	monome_led_set(monome->dev, monome->cols - 1, 0,
-	               !!LIST_MEMBER_T(state.active_session)->next->next);
-	monome_led_set(monome->dev, monome->cols - 2, 0,
-	               !!LIST_MEMBER_T(state.active_session)->prev->prev);
+	r_monome_led_set(monome, monome->cols - 1, 0,
+	                 !!LIST_MEMBER_T(state.active_session)->next->next);
+	r_monome_led_set(monome, monome->cols - 2, 0,
+	                 !!LIST_MEMBER_T(state.active_session)->prev->prev);
 }
 
 static void control_row_handler(r_monome_t *monome, uint_t x, uint_t y, uint_t event_type, void *user_arg) {
@@ -131,6 +105,17 @@ static void control_row_handler(r_monome_t *monome, uint_t x, uint_t y, uint_t e
 	if( x >= monome->cols || !(callback = &monome->controls[x]) )
 		return;
 
+	/* with an empty row held down, a group's button sets its volume from
+	   where along the row it's held instead of turning it off.  the
+	   engine takes it up on the cycle it's logged with. */
+	if( monome->held_row && callback->cb == group_off_handler ) {
+		if( event_type == MONOME_BUTTON_DOWN )
+			engine_command(volume_command, callback->data, NULL,
+			               monome->held_col / (double) (monome->cols - 1));
+
+		return;
+	}
+
 	if( callback->cb )
 		return callback->cb(monome, x, y, event_type, callback);
 
@@ -167,26 +152,84 @@ void file_row_handler(r_monome_t *monome, uint_t x, uint_t y, uint_t event_type,
 	if( !f->monome_in_cb )
 		return;
 
+	/* arming a capture slot isn't a cut, so patterns don't get it */
+	if( f->capture && capture_grid_in(f, event_type) )
+		return;
+
 	pattern_record(f->monome_in_cb, f, x, y, event_type);
 	f->monome_in_cb(monome, x, y, event_type, f); 
 }
 
-static void button_handler(const monome_event_t *e, void *user_data) {
-	r_monome_t *monome = user_data;
+void r_monome_handle_event(r_monome_t *monome, uint_t x, uint_t y, uint_t event_type) {
 	r_monome_handler_t *callback;
+	uint64_t frame, target;
+
+	if( y >= monome->rows || !(callback = &monome->callbacks[y]) )
+		return;
+
+	trace_begin(TRACE_INPUT, (y << 8) | x);
+
+	engine_input_begin();
+
+	if( callback->cb )
+		callback->cb(monome, x, y, event_type, callback);
+	else {
+		/* nothing's there, but see pattern_handler() and
+		   control_row_handler().  these get logged all the same, so
+		   that a replay holds the same rows down. */
+		if( event_type == MONOME_BUTTON_DOWN ) {
+			monome->held_row = y;
+			monome->held_col = x;
+		} else if( monome->held_row == y )
+			monome->held_row = 0;
+	}
 
-	int event_x, event_y, event_type;
+	frame = engine_input_end(&target);
+	timeline_log_event(frame, target, x, y, event_type);
 
-	event_x    = e->grid.x;
-	event_y    = e->grid.y;
-	event_type = e->event_type;
+	/* whatever the press did, the display ought to have a look */
+	r_monome_wake_display(monome);
 
-	if( event_y >= monome->rows ||
-		!(callback = &monome->callbacks[event_y]) ||
-		!callback->cb )
+	trace_end(TRACE_INPUT, (y << 8) | x);
+}
+
+/**
+ * called from any thread (the engine included) after changing something
+ * the display thread would want to show.  only the first call after the
+ * display parks posts anything, so this is cheap to call a lot.
+ */
+void r_monome_wake_display(r_monome_t *monome) {
+	if( __atomic_exchange_n(&monome->display_parked, 0, __ATOMIC_SEQ_CST) )
+		sem_post(&monome->display_wake);
+}
+
+/**
+ * cut into whichever loop is mapped at x, y as if it was pressed, minus
+ * everything else a press does (pattern recording, the control row),
+ * none of which is safe to do from the audio thread.
+ */
+void r_monome_cut(r_monome_t *monome, uint_t x, uint_t y) {
+	r_monome_handler_t *row;
+	file_t *f;
+
+	if( y < 1 || y >= monome->rows )
+		return;
+
+	row = &monome->callbacks[y];
+
+	if( row->cb != file_row_handler || !(f = row->data) || !f->monome_in_cb )
+		return;
+
+	/* nor anything a bounce is recording */
+	if( capture_locked(f->group) )
 		return;
 
-	callback->cb(monome, event_x, event_y, event_type, callback);
+	f->monome_in_cb(monome, x, y, MONOME_BUTTON_DOWN, f);
+}
+
+static void button_handler(const monome_event_t *e, void *user_data) {
+	stats_osc_in();
+	r_monome_handle_event(user_data, e->grid.x, e->grid.y, e->event_type);
 }
 
 static void initialize_file_callbacks(r_monome_t *monome) {
@@ -196,6 +239,8 @@ static void initialize_file_callbacks(r_monome_t *monome) {
 	list_member_t *m;
 	file_t *f;
 
+	/* rows no file covers stay clear.  the files needn't be in row
+	   order (bounces go on the end), so that's done up front. */
 	for( i = 1; i < monome->rows; i++ ) {
 		monome->callbacks[i].cb = NULL;
 		monome->callbacks[i].data = NULL;
@@ -219,9 +264,6 @@ static void initialize_file_callbacks(r_monome_t *monome) {
 			row->data  = f;
 		}
 	}
-
-	for( y += row_span; y < monome->rows; y++ )
-		monome->callbacks[y].cb = NULL;
 }
 
 static void initialize_control_callbacks(r_monome_t *monome) {
@@ -263,6 +305,8 @@ static void initialize_callbacks(r_monome_t *monome) {
 
 void *r_monome_loop_thread(void *user_data) {
 	monome_t *monome = user_data;
+
+	trace_thread("input");
 	monome_event_loop(monome);
 
 	return NULL;
@@ -270,15 +314,49 @@ void *r_monome_loop_thread(void *user_data) {
 
 void r_monome_run_thread(r_monome_t *monome) {
 	pthread_create(&monome->thread, NULL, r_monome_loop_thread, monome->dev);
+	threads_apply(monome->thread, &state.config.input_thread, "input");
 }
 
 void r_monome_stop_thread(r_monome_t *monome) {
 	pthread_cancel(monome->thread);
 }
 
+/* the device is NULL when running offline, so all LED output goes
+   through these rather than straight to libmonome.  in freewheel mode
+   the grid would only be a blur, so nothing is sent then either. */
+
+void r_monome_led_set(r_monome_t *monome, uint_t x, uint_t y, uint_t on) {
+	if( !monome->dev || state.freewheeling )
+		return;
+
+	trace_instant(TRACE_LED, y);
+	monome_led_set(monome->dev, x, y, on);
+	stats_osc_out();
+}
+
+void r_monome_led_row(r_monome_t *monome, uint_t x_off, uint_t y, size_t count, const uint8_t *data) {
+	if( !monome->dev || state.freewheeling )
+		return;
+
+	trace_instant(TRACE_LED, y);
+	monome_led_row(monome->dev, x_off, y, count, data);
+	stats_osc_out();
+}
+
+void r_monome_led_all(r_monome_t *monome, uint_t on) {
+	if( !monome->dev || state.freewheeling )
+		return;
+
+	trace_instant(TRACE_LED, 0);
+	monome_led_all(monome->dev, on);
+	stats_osc_out();
+}
+
 void r_monome_free(r_monome_t *monome) {
-	monome_led_all(monome->dev, 0);
-	monome_close(monome->dev);
+	r_monome_led_all(monome, 0);
+
+	if( monome->dev )
+		monome_close(monome->dev);
 
 	free(monome->callbacks);
 	free(monome->controls);
@@ -286,6 +364,44 @@ void r_monome_free(r_monome_t *monome) {
 	free(monome);
 }
 
+static r_monome_t *r_monome_new() {
+	r_monome_t *monome;
+
+	assert(state.config.cols > 0);
+	assert(state.config.rows > 0);
+
+	if( !(monome = calloc(sizeof(r_monome_t), 1)) )
+		return NULL;
+
+	/* eventually we will support several monomes */
+	monome->cols     = state.config.cols;
+	monome->rows     = state.config.rows;
+	monome->mod_keys = 0;
+
+	monome->quantize_field = 0;
+	monome->dirty_field    = 0;
+
+	sem_init(&monome->display_wake, 0, 0);
+	monome->display_parked = 0;
+
+	monome->callbacks = calloc(sizeof(r_monome_handler_t), state.config.rows);
+	monome->controls  = calloc(sizeof(r_monome_handler_t), state.config.cols);
+
+	return monome;
+}
+
+int r_monome_init_offline() {
+	r_monome_t *monome;
+
+	if( !(monome = r_monome_new()) )
+		return -1;
+
+	initialize_callbacks(monome);
+	state.monome = monome;
+
+	return 0;
+}
+
 int r_monome_init() {
 	r_monome_t *monome;
 	char *buf;
@@ -293,14 +409,15 @@ int r_monome_init() {
 	assert(state.config.osc_prefix);
 	assert(state.config.osc_host_port);
 	assert(state.config.osc_listen_port);
-	assert(state.config.cols > 0);
-	assert(state.config.rows > 0);
 
-	monome = calloc(sizeof(r_monome_t), 1);
+	if( !(monome = r_monome_new()) )
+		return -1;
 
 	asprintf(&buf, "osc.udp://127.0.0.1:%s/%s", state.config.osc_host_port, state.config.osc_prefix);
 
 	if( !(monome->dev = monome_open(buf, state.config.osc_listen_port)) ) {
+		free(monome->callbacks);
+		free(monome->controls);
 		free(monome);
 		free(buf);
 		return -1;
@@ -311,19 +428,9 @@ int r_monome_init() {
 	monome_register_handler(monome->dev, MONOME_BUTTON_DOWN, button_handler, monome);
 	monome_register_handler(monome->dev, MONOME_BUTTON_UP, button_handler, monome);
 
-	/* eventually we will support several monomes */
-	monome->cols     = state.config.cols;
-	monome->rows     = state.config.rows;
-	monome->mod_keys = 0;
-
-	monome->quantize_field = 0;
-	monome->dirty_field    = 0;
-
-	monome->callbacks = calloc(sizeof(r_monome_handler_t), state.config.rows);
-	monome->controls  = calloc(sizeof(r_monome_handler_t), state.config.cols);
 	initialize_callbacks(monome);
 
-	monome_led_all(monome->dev, 0);
+	r_monome_led_all(monome, 0);
 
 	state.monome = monome;
 
@@ -0,0 +1,255 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * the offline driver runs the engine without JACK or a monome.  grid
+ * events come from a timeline, the master mix goes to a sound file (if
+ * asked for) and we time every cycle along the way.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sndfile.h>
+
+#include "capture.h"
+#include "engine.h"
+#include "midi.h"
+#include "offline.h"
+#include "rmonome.h"
+#include "rtcheck.h"
+#include "session.h"
+#include "timeline.h"
+#include "trace.h"
+#include "util.h"
+
+#define DEFAULT_PERIOD      256
+#define DEFAULT_SAMPLE_RATE 48000
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+extern state_t state;
+
+static engine_event_t events[MIDI_MAX_EVENTS];
+
+static SNDFILE *open_output(const char *path, jack_nframes_t rate) {
+	SNDFILE *snd;
+	SF_INFO info;
+
+	memset(&info, 0, sizeof(info));
+	info.samplerate = rate;
+	info.channels   = 2;
+	info.format     = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+
+	if( !(snd = sf_open(path, SFM_WRITE, &info)) )
+		printf("offline: couldn't open %s for writing: %s\n", path, sf_strerror(NULL));
+
+	return snd;
+}
+
+/* checksum of the raw master output, so two renders of the same timeline
+   can be compared without keeping the sound files around */
+static uint64_t checksum(uint64_t hash, const jack_default_audio_sample_t *buf, size_t len) {
+	const unsigned char *c = (const unsigned char *) buf;
+	size_t i;
+
+	for( i = 0; i < len * sizeof(*buf); i++ )
+		hash = (hash ^ c[i]) * FNV_PRIME;
+
+	return hash;
+}
+
+static void report(const timeline_t *tl, uint64_t frames, uint64_t cycles, uint64_t total_ns,
+                   uint64_t worst_ns, const uint64_t *group_ns, uint64_t hash,
+                   jack_nframes_t period, jack_nframes_t rate) {
+	double budget_ns;
+	int i;
+
+	budget_ns = period * 1000000000.0 / rate;
+
+	printf("\nrendered %.2f s (%" PRIu64 " frames, %" PRIu64 " cycles of %u) at %u Hz, %d events\n",
+	       frames / (double) rate, frames, cycles, period, rate, tl->count);
+
+	if( !frames || !cycles )
+		return;
+
+	printf("    output:  %016" PRIx64 "\n", hash);
+
+	printf("    engine:  %8.2f ns/frame, mean cycle %8.2f us, worst cycle %8.2f us (%.2f%% of a period)\n",
+	       total_ns / (double) frames, total_ns / (cycles * 1000.0),
+	       worst_ns / 1000.0, 100.0 * worst_ns / budget_ns);
+
+	for( i = 0; i < state.group_count; i++ )
+		printf("    group %d: %8.2f ns/frame\n", i + 1, group_ns[i] / (double) frames);
+
+	printf("\n");
+}
+
+int offline_render(const char *timeline_path, const char *output_path,
+                   jack_nframes_t period, jack_nframes_t rate) {
+	jack_default_audio_sample_t *bufs, *mix;
+	uint64_t frame, cycles, total_ns, worst_ns, t, hash, *group_ns;
+	jack_nframes_t nframes, i;
+	const timeline_event_t *e;
+	engine_cycle_t cycle;
+	SNDFILE *out;
+	timeline_t *tl;
+	int j, k, ret, channels;
+	group_t *g;
+
+	if( !(tl = timeline_load(timeline_path)) )
+		return 1;
+
+	if( !period )
+		period = ( tl->period ) ? tl->period : DEFAULT_PERIOD;
+
+	if( !rate )
+		rate = ( tl->rate ) ? tl->rate : DEFAULT_SAMPLE_RATE;
+
+	tl->end = timeline_end(tl, rate);
+
+	state.sample_rate = rate;
+
+	if( capture_prepare(rate) ) {
+		timeline_free(tl);
+		return 1;
+	}
+
+	session_activate(SESSION_T(state.sessions.head.next));
+
+	if( r_monome_init_offline() ) {
+		timeline_free(tl);
+		return 1;
+	}
+
+	out = NULL;
+	ret = 1;
+
+	for( j = channels = 0; j < state.group_count; j++ )
+		channels += state.groups[j].channels;
+
+	bufs     = calloc(sizeof(jack_default_audio_sample_t), period * channels + 1);
+	mix      = calloc(sizeof(jack_default_audio_sample_t), period * 2);
+	group_ns = calloc(sizeof(uint64_t), state.group_count);
+
+	if( !bufs || !mix || !group_ns ) {
+		fprintf(stderr, "offline: couldn't allocate buffers, aieee!\n");
+		goto out;
+	}
+
+	if( output_path && !(out = open_output(output_path, rate)) )
+		goto out;
+
+	for( j = channels = 0; j < state.group_count; j++ ) {
+		g = &state.groups[j];
+
+		for( k = 0; k < g->channels; k++ )
+			g->output_buffers[k] = bufs + (period * channels++);
+	}
+
+	cycle.rate       = rate;
+	cycle.group_ns   = group_ns;
+	cycle.clock_us   = 0;
+	cycle.events     = events;
+	cycle.nevents    = 0;
+	cycle.want_clock = 0;
+	cycle.input[0]   = NULL;
+	cycle.input[1]   = NULL;
+
+	trace_thread("audio");
+
+	e = tl->events;
+	cycles = total_ns = worst_ns = 0;
+	hash = FNV_OFFSET;
+
+	for( frame = 0; frame < tl->end; frame += nframes ) {
+		nframes = ( tl->end - frame < period ) ? tl->end - frame : period;
+		cycle.nevents = 0;
+
+		for( ; e < tl->events + tl->count && e->frame < frame + nframes; e++ ) {
+			/* MIDI goes in as the JACK driver would hand it over */
+			if( timeline_is_midi(e) ) {
+				if( cycle.nevents < MIDI_MAX_EVENTS )
+					timeline_engine_event(e, frame, &events[cycle.nevents++]);
+
+				continue;
+			}
+
+			engine_input_at(e->frame, e->target);
+			r_monome_handle_event(state.monome, e->x, e->y, e->type);
+		}
+
+		cycle.nframes = nframes;
+
+		t = engine_now_ns();
+		trace_begin(TRACE_PROCESS, nframes);
+		rtcheck_enter();
+		engine_process(&cycle);
+		rtcheck_leave();
+		trace_end(TRACE_PROCESS, nframes);
+		t = engine_now_ns() - t;
+
+		total_ns += t;
+		cycles++;
+
+		if( t > worst_ns )
+			worst_ns = t;
+
+		/* sum the groups the way group_mix_in does under JACK */
+		memset(mix, 0, sizeof(jack_default_audio_sample_t) * nframes * 2);
+
+		for( j = 0; j < state.group_count; j++ ) {
+			g = &state.groups[j];
+
+			if( g->silent >= nframes )
+				continue;
+
+			for( k = 0; k < MAX(g->channels, 2); k++ )
+				for( i = 0; i < nframes; i++ )
+					mix[i * 2 + k % 2] += g->output_buffers[k % g->channels][i];
+		}
+
+		hash = checksum(hash, mix, nframes * 2);
+
+		if( out && sf_writef_float(out, mix, nframes) != nframes ) {
+			printf("offline: error writing %s: %s\n", output_path, sf_strerror(out));
+			goto out;
+		}
+	}
+
+	report(tl, frame, cycles, total_ns, worst_ns, group_ns, hash, period, rate);
+
+	/* so that a CI run of the renderer fails if the engine did
+	   anything it shouldn't have */
+	ret = ( rtcheck_report() ) ? 1 : 0;
+
+out:
+	if( out )
+		sf_close(out);
+
+	free(bufs);
+	free(mix);
+	free(group_ns);
+	timeline_free(tl);
+
+	return ret;
+}
@@ -17,23 +17,61 @@
  */
 
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "types.h"
+#include "capture.h"
+#include "engine.h"
 #include "file.h"
+#include "trace.h"
 #include "list.h"
 #include "pattern.h"
+#include "rmonome.h"
 #include "util.h"
-#include "file.h"
 
 extern state_t state;
 
-void pattern_record(r_monome_callback_t cb, void *victim, uint_t x, uint_t y, uint_t type) {
+/**
+ * the patterns, their steps and which button each is on all belong to
+ * the engine.  a press on the grid only allocates what the engine might
+ * need and sends it over (see engine_command()), and whatever the engine
+ * doesn't use, or is done with, comes back to be freed.
+ */
+
+static void discard_pattern(void *p) {
+	pattern_free(p);
+}
+
+static r_monome_handler_t *button(pattern_t *self) {
+	return &self->monome->controls[self->monome->cols - 4 + self->idx];
+}
+
+/* the display thread does the actual LED, see r_monome_t */
+static void light(pattern_t *self, int on) {
+	__atomic_store_n(&self->monome->pattern_lights[self->idx], on, __ATOMIC_RELEASE);
+	r_monome_wake_display(self->monome);
+}
+
+static void add_step(void *arg, void *data, double value) {
 	pattern_t *p = state.pattern_rec;
+	pattern_step_t *step = data;
+
+	if( !p ) {
+		engine_discard(step, free);
+		return;
+	}
+
+	list_push_raw(&p->steps, TAIL, LIST_MEMBER_T(step));
+	p->current_step = step;
+}
+
+void pattern_record(r_monome_callback_t cb, void *victim, uint_t x, uint_t y, uint_t type) {
 	pattern_step_t *step;
 
-	if( !p )
+	/* pattern playback doesn't record itself */
+	if( !engine_request_event() )
 		return;
 
 	if( !(step = calloc(1, sizeof(pattern_step_t))) ) {
@@ -48,8 +86,8 @@ void pattern_record(r_monome_callback_t cb, void *victim, uint_t x, uint_t y, ui
 	step->y = y;
 	step->type = type;
 
-	list_push_raw(&p->steps, TAIL, LIST_MEMBER_T(step));
-	p->current_step = step;
+	if( engine_command(add_step, NULL, step, 0) )
+		free(step);
 }
 
 void pattern_status_set(pattern_t *self, pattern_status_t nstatus) {
@@ -70,7 +108,83 @@ void pattern_status_set(pattern_t *self, pattern_status_t nstatus) {
 		self->step_delay = 0;
 	}
 
-	self->status = nstatus;
+	/* the input thread looks before bouncing */
+	__atomic_store_n(&self->status, nstatus, __ATOMIC_RELEASE);
+}
+
+void pattern_stop(pattern_t *self) {
+	pattern_status_set(self, PATTERN_STATUS_INACTIVE);
+	list_remove_raw(LIST_MEMBER_T(self));
+
+	__atomic_store_n(&button(self)->data, NULL, __ATOMIC_RELEASE);
+	light(self, 0);
+
+	engine_discard(self, discard_pattern);
+}
+
+static void finish(pattern_t *self) {
+	if( stlist_is_empty(self->steps) ) {
+		pattern_stop(self);
+		return;
+	}
+
+	pattern_status_set(self, PATTERN_STATUS_ACTIVE);
+	light(self, 1);
+}
+
+static void start(pattern_t *self, r_monome_handler_t *b) {
+	int length = state.pattern_lengths[self->idx];
+
+	self->status = PATTERN_STATUS_RECORDING;
+	self->step_delay = ( length ) ? rintf(floor(length / state.beat_multiplier)) : 0;
+
+	list_push_raw(state.patterns, TAIL, LIST_MEMBER_T(self));
+	state.pattern_rec = self;
+
+	__atomic_store_n(&b->data, self, __ATOMIC_RELEASE);
+
+	/* one with a length blinks until it's done */
+	light(self, ( self->step_delay ) ? -self->step_delay : 1);
+}
+
+static void press(void *arg, void *data, double value) {
+	r_monome_handler_t *b = arg;
+	pattern_t *p = b->data;
+
+	if( !p ) {
+		if( state.pattern_rec )
+			finish(state.pattern_rec);
+
+		start(data, b);
+		return;
+	}
+
+	engine_discard(data, discard_pattern);
+
+	/* leave it alone while it's being bounced */
+	if( p->bounce )
+		return;
+
+	if( p->status == PATTERN_STATUS_RECORDING )
+		finish(p);
+	else
+		pattern_stop(p);
+}
+
+void pattern_press(r_monome_t *monome, r_monome_handler_t *button, int idx) {
+	pattern_t *p;
+
+	/* a new pattern, in case the engine finds the button free */
+	if( !(p = pattern_new()) ) {
+		fprintf(stderr, "WARNING: can't allocate pattern.\n");
+		return;
+	}
+
+	p->idx    = idx;
+	p->monome = monome;
+
+	if( engine_command(press, button, p, 0) )
+		pattern_free(p);
 }
 
 void pattern_process(pattern_t *self) {
@@ -81,17 +195,13 @@ void pattern_process(pattern_t *self) {
 		break;
 
 	case PATTERN_STATUS_RECORDING:
-		if( stlist_is_empty(self->steps) )
+		if( !step )
 			break;
 
 		step->delay++;
 
-		if( self->step_delay && --self->step_delay <= 0 ) {
-			pattern_status_set(self, PATTERN_STATUS_ACTIVE);
-
-			/* XXX: hack */
-			monome_led_set(self->monome->dev, self->monome->cols - 4 + self->idx, 0, 1);
-		}
+		if( self->step_delay && --self->step_delay <= 0 )
+			finish(self);
 
 		break;
 
@@ -101,7 +211,12 @@ void pattern_process(pattern_t *self) {
 			break;
 		}
 
+		/* a bounce starts recording as the pattern comes back round */
+		if( self->bounce && step == PATTERN_STEP_T(self->steps.head.next) )
+			capture_bounce_start(__atomic_load_n(&self->bounce, __ATOMIC_ACQUIRE));
+
 		do {
+			trace_instant(TRACE_PATTERN_STEP, self->idx);
 			step->cb(self->monome, step->x, step->y, step->type, step->victim);
 
 			self->step_delay = step->delay;
@@ -133,7 +248,11 @@ void pattern_free(pattern_t *self) {
 }
 
 pattern_t *pattern_new() {
-	pattern_t *self = calloc(1, sizeof(pattern_t));
+	pattern_t *self;
+
+	if( !(self = calloc(1, sizeof(pattern_t))) )
+		return NULL;
+
 	list_init(&self->steps);
 
 	return self;
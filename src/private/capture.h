@@ -0,0 +1,69 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_CAPTURE_H
+#define _ROVE_CAPTURE_H
+
+#include "types.h"
+
+/**
+ * capture slots are rows that record from the capture_in ports instead
+ * of playing a file from disk.  their buffers are allocated up front,
+ * once the sample rate is known, so recording is just a copy on the
+ * audio thread.  pressing an empty slot (or holding one button on a
+ * slot and pressing a second) punches in on the group's next quantize
+ * boundary; "capture" beats later the take punches out, starts looping
+ * from the top, and a writer thread saves it next to the session.
+ */
+
+/**
+ * a pattern can also be bounced into a new slot on an empty row: one
+ * whole cycle of it is recorded from the groups it plays, starting as
+ * it comes back round to its first step, and when that's done the slot
+ * takes over from the pattern.  this happens in real time rather than
+ * in a separate offline pass, since the engine only exists once, but it
+ * means the bounce is exactly what the pattern sounded like.  the groups
+ * are recorded at unity, before their volumes, since the slot gets its
+ * group's volume again when it plays.  from when the pattern's handed
+ * over until the take's done, cuts, group offs and volume changes on
+ * those groups from anywhere but the pattern are ignored.
+ */
+
+/* no more than this many slots can be recording at once */
+#define CAPTURE_MAX_RECORDING 16
+
+/* ...or exist at all */
+#define CAPTURE_MAX_SLOTS 64
+
+file_t *capture_new(double beats, int channels, session_t *session);
+void capture_free(capture_t *self);
+
+int capture_prepare(jack_nframes_t sample_rate);
+int capture_grid_in(file_t *self, uint_t type);
+int capture_can_cut(file_t *self);
+
+int capture_bounce(pattern_t *pattern, int y);
+
+/* engine side */
+void capture_bounce_start(file_t *self);
+int capture_locked(const group_t *group);
+jack_nframes_t capture_block(jack_nframes_t nframes);
+uint32_t capture_groups();
+void capture_record(const jack_default_audio_sample_t *const *input, jack_nframes_t offset, jack_nframes_t nframes);
+
+#endif
@@ -16,7 +16,12 @@
  * along with rove.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "list.h"
+/* most pairs a single block can hold, anything past that is dropped */
+#define CONF_MAX_PAIRS 64
+
+/* slots in each section's var lookup table, must be a power of two
+   and comfortably larger than the longest conf_var_t array */
+#define CONF_HASH_SIZE 64
 
 typedef enum {
 	INT,
@@ -39,9 +44,12 @@ struct conf_var {
 	int val;
 };
 
+/* key and value point straight into the mapped conf file and are
+   *not* NUL-terminated.  they're only valid for the duration of the
+   section callback, so use the conf_pair_* helpers to get at them. */
 struct conf_pair {
-	char *key;
-	char *value;
+	const char *key;
+	const char *value;
 
 	const conf_var_t *var;
 	int klen;
@@ -55,9 +63,18 @@ struct conf_section {
 	void *cb_arg;
 
 	int start_line;
-	list_t *pairs;
+
+	/* filled in by conf_load() */
+	const conf_var_t *var_hash[CONF_HASH_SIZE];
+
+	conf_pair_t pairs[CONF_MAX_PAIRS];
+	int npairs;
 };
 
 int conf_load(const char *path, conf_section_t *sections, int cd);
 void conf_default_section_callback(const conf_section_t *section);
-int conf_getvar(const conf_section_t *section, conf_pair_t **current_pair);
+int conf_getvar(const conf_section_t *section, const conf_pair_t **current_pair);
+
+long conf_pair_long(const conf_pair_t *pair);
+double conf_pair_double(const conf_pair_t *pair);
+char *conf_pair_strdup(const conf_pair_t *pair);
@@ -0,0 +1,147 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_ENGINE_H
+#define _ROVE_ENGINE_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+typedef struct engine_fired engine_fired_t;
+typedef struct engine_event engine_event_t;
+typedef struct engine_clock engine_clock_t;
+typedef struct engine_cycle engine_cycle_t;
+
+/* more than this many grid-originated requests firing in one cycle
+   just don't get their latency measured */
+#define ENGINE_MAX_FIRED 16
+
+#define ENGINE_NOT_SEEN UINT64_MAX
+#define ENGINE_NO_TARGET UINT64_MAX
+
+/* commands from the input thread that haven't been run yet, and
+   things the engine's done with that haven't been freed yet */
+#define ENGINE_MAX_COMMANDS 256
+#define ENGINE_MAX_DISCARDS 256
+
+/* MIDI clock messages past this many in one period are dropped */
+#define ENGINE_MAX_CLOCK 128
+
+#define ENGINE_CLOCK_PPQN 24
+
+typedef void (*engine_command_callback_t)(void *arg, void *data, double value);
+typedef void (*engine_discard_callback_t)(void *ptr);
+
+struct engine_fired {
+	uint64_t arrival_us;  /* when the grid event came in */
+	uint64_t seen_frame;  /* first cycle that could act on it */
+	uint64_t frame;       /* where it took effect */
+};
+
+typedef enum {
+	ENGINE_EVENT_CUT,    /* cut into the loop at grid position x, y */
+	ENGINE_EVENT_VOLUME  /* set group y's volume to value */
+} engine_event_type_t;
+
+/* input that arrives on the audio thread already timed (MIDI), applied
+   at exactly its offset into the period */
+struct engine_event {
+	jack_nframes_t offset;
+	engine_event_type_t type;
+
+	uint_t x;
+	uint_t y;
+	double value;
+};
+
+typedef enum {
+	ENGINE_CLOCK_TICK,
+	ENGINE_CLOCK_START,
+	ENGINE_CLOCK_STOP
+} engine_clock_type_t;
+
+struct engine_clock {
+	jack_nframes_t offset;
+	engine_clock_type_t type;
+};
+
+/**
+ * one run of the engine.  the driver (jack.c or offline.c) points each
+ * group's output buffers at nframes worth of memory, fills in the top
+ * half of this and calls engine_process().
+ */
+
+struct engine_cycle {
+	jack_nframes_t nframes;
+	jack_nframes_t rate;
+
+	/* if set, the time spent in each group's process callback is
+	   added to group_ns[group index], in nanoseconds. */
+	uint64_t *group_ns;
+
+	/* when this cycle's period began by the driver's clock (in
+	   engine_time_us() terms), or zero if it can't tell.  unquantized
+	   cuts are placed with it. */
+	uint64_t clock_us;
+
+	/* timed input for this period, in order of offset */
+	const engine_event_t *events;
+	int nevents;
+
+	/* set if the driver wants MIDI clock */
+	int want_clock;
+
+	/* the capture_in ports, for recording into capture slots.  NULL
+	   if there's no audio input, which records silence. */
+	const jack_default_audio_sample_t *input[2];
+
+	/* filled in by engine_process() */
+	uint64_t start_frame;  /* frames run since the engine started */
+	uint64_t start_us;     /* engine_time_us() at the start of the cycle */
+
+	int blocks;      /* sub-blocks the period was split into */
+	int voices;      /* groups with an active loop */
+	int src_voices;  /* ...of which went through libsamplerate */
+	int commands;    /* quantized callbacks fired */
+
+	int nfired;
+	engine_fired_t fired[ENGINE_MAX_FIRED];
+
+	int nclock;
+	engine_clock_t clock[ENGINE_MAX_CLOCK];
+};
+
+void engine_process(engine_cycle_t *cycle);
+uint64_t engine_now_ns();
+uint64_t engine_time_us();
+
+int engine_command(engine_command_callback_t cb, void *arg, void *data, double value);
+void engine_discard(void *ptr, engine_discard_callback_t cb);
+
+void engine_input_at(uint64_t frame, uint64_t target);
+uint64_t engine_input_begin();
+uint64_t engine_input_end(uint64_t *target);
+uint64_t engine_next_frame();
+uint64_t engine_request_frame();
+uint_t engine_request_event();
+uint64_t engine_request_arrival();
+uint64_t engine_request_target();
+int engine_request_visible(uint64_t frame, uint_t event);
+
+#endif
@@ -24,20 +24,23 @@
 
 #include "types.h"
 
+/* the most channels a loop can have (seventh order ambisonics), and how
+   many samples of resampled audio file_process() gathers up at once */
+#define FILE_MAX_CHANNELS 64
+#define FILE_SRC_SCRATCH  1024
+
 #define file_mapped(x) (x->mapped_monome->callbacks[x->y].data == x)
 #define file_is_active(f) (f->status == FILE_STATUS_ACTIVE)
-#define file_get_play_pos(f) (f->play_offset * f->channels)
 
 file_t *file_new_from_path(const char *path);
+file_t *file_new_from_buffer(float *data, sf_count_t frames, sf_count_t channels, sf_count_t sample_rate);
 void file_free(file_t *self);
 
-void file_set_play_pos(file_t *self, sf_count_t pos);
-void file_inc_play_pos(file_t *self, sf_count_t delta);
-
 void file_deactivate(file_t *self);
 void file_seek(file_t *self);
 
 void file_on_quantize(file_t *self, quantize_callback_t cb);
+void file_on_cycle(file_t *self, quantize_callback_t cb);
 void file_force_monome_update(file_t *self);
 
 #endif
@@ -18,4 +18,21 @@
 
 #include "types.h"
 
+/* how long a volume change takes to ramp in, in seconds */
+#define GROUP_GAIN_RAMP 0.005
+
+/**
+ * when n channels feed m, they're paired off round-robin: for each k up
+ * to the larger of the two, channel k % n goes into channel k % m.  mono
+ * spreads across everything, stereo onto quad goes l r l r, and quad
+ * folds down onto stereo the same way.  this is how files play into
+ * groups, how groups get to the stereo master, and how capture_in gets
+ * into a capture slot.
+ */
+
 void group_activate_file(file_t *file);
+group_t *group_array_new(uint_t group_count);
+void group_set_volume(group_t *self, double volume);
+void group_gain_update(group_t *self, jack_nframes_t sample_rate);
+void group_gain_advance(group_t *self, jack_nframes_t nframes);
+void group_apply_gain(group_t *self, jack_default_audio_sample_t **buffers, jack_nframes_t nframes);
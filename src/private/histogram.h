@@ -0,0 +1,54 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_HISTOGRAM_H
+#define _ROVE_HISTOGRAM_H
+
+#include <stdint.h>
+
+/**
+ * log2 histograms with four steps per octave, so every bucket is within
+ * 25% of its neighbours.  histogram_add() only does relaxed atomic adds
+ * and is fine to call from the JACK thread.
+ */
+
+#define HISTOGRAM_STEPS   4
+#define HISTOGRAM_OCTAVES 32
+#define HISTOGRAM_BUCKETS (HISTOGRAM_STEPS * HISTOGRAM_OCTAVES)
+
+typedef struct histogram histogram_t;
+
+struct histogram {
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+void histogram_add(histogram_t *self, uint64_t value);
+
+/* copy out the current counts, either leaving them be or resetting
+   them as we go */
+void histogram_copy(histogram_t *self, histogram_t *into);
+void histogram_take(histogram_t *self, histogram_t *into);
+
+/* upper bound of the bucket the q'th quantile falls in */
+uint64_t histogram_quantile(const histogram_t *self, double q);
+
+#endif
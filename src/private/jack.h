@@ -27,4 +27,7 @@ void r_jack_deactivate();
 int  r_jack_activate();
 int  r_jack_init();
 
+/* play a timeline through JACK in freewheel mode, recording to a file */
+int  r_jack_render(const char *timeline_path, const char *output_path);
+
 #endif
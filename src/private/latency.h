@@ -0,0 +1,45 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_LATENCY_H
+#define _ROVE_LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+/**
+ * how long it takes from a button press to the sound it makes leaving
+ * the JACK callback, split up into:
+ *
+ *   input     handling the event on the input thread
+ *   queue     waiting for the first engine cycle that could act on it
+ *   quantize  waiting for the next quantize boundary (on purpose)
+ *   overhead  everything but the quantize wait
+ *   total     all of it
+ *
+ * all in microseconds on JACK's clock.
+ */
+
+void latency_input(uint64_t us);
+void latency_cycle(const engine_cycle_t *cycle, uint64_t end_us);
+
+void latency_write(FILE *f);
+
+#endif
@@ -0,0 +1,30 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_MIDI_H
+#define _ROVE_MIDI_H
+
+#include "engine.h"
+
+/* more events than this in one period just get dropped */
+#define MIDI_MAX_EVENTS 128
+
+int midi_read(void *port_buffer, engine_event_t *events, int max);
+void midi_write_clock(void *port_buffer, const engine_cycle_t *cycle);
+
+#endif
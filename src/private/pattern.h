@@ -21,9 +21,13 @@
 
 #include "types.h"
 
+/* input side */
 void pattern_record(r_monome_callback_t cb, void *victim, uint_t x, uint_t y, uint_t type);
+void pattern_press(r_monome_t *monome, r_monome_handler_t *button, int idx);
 
+/* engine side */
 void pattern_status_set(pattern_t *self, pattern_status_t nstatus);
+void pattern_stop(pattern_t *self);
 void pattern_process(pattern_t *self);
 
 pattern_t *pattern_new();
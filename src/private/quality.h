@@ -0,0 +1,43 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_QUALITY_H
+#define _ROVE_QUALITY_H
+
+#include <stdint.h>
+
+#include <jack/jack.h>
+
+/**
+ * when the engine gets close to using up its period, varispeed loops
+ * step down a ladder of cheaper resamplers: libsamplerate's sinc, then
+ * cubic, then linear interpolation.  once there's room again they step
+ * back up.  the load is averaged over a few cycles, it has to drop well
+ * below where it went up before anything steps back up, and a ladder
+ * that keeps bouncing waits longer each time before trying again.
+ */
+
+#define DEFAULT_QUALITY_HIGH 80  /* percent of a period */
+#define DEFAULT_QUALITY_LOW  50
+
+int quality_init();
+void quality_cycle(uint64_t ns, jack_nframes_t nframes, jack_nframes_t rate);
+
+const char *quality_name(int quality);
+
+#endif
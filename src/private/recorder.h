@@ -0,0 +1,43 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_RECORDER_H
+#define _ROVE_RECORDER_H
+
+#include <stdint.h>
+
+#include <jack/jack.h>
+
+/**
+ * records the master mix (and, with "groups" set under [record], each
+ * group's output) to disk.  the JACK thread only copies into a ring
+ * buffer per stream, a writer thread does the rest.  if the writer
+ * falls so far behind that a ring fills up, whole periods get dropped
+ * and counted instead of blocking the audio thread.
+ */
+
+int recorder_start(const char *path, jack_nframes_t sample_rate);
+void recorder_stop();
+
+void recorder_process(const jack_default_audio_sample_t *master_l,
+                      const jack_default_audio_sample_t *master_r, jack_nframes_t nframes);
+
+/* frames lost to full ring buffers, across every stream */
+uint64_t recorder_dropped();
+
+#endif
@@ -28,8 +28,17 @@
 void r_monome_run_thread(r_monome_t *monome);
 void r_monome_stop_thread(r_monome_t *monome);
 
+void r_monome_handle_event(r_monome_t *monome, uint_t x, uint_t y, uint_t event_type);
+void r_monome_cut(r_monome_t *monome, uint_t x, uint_t y);
+void r_monome_wake_display(r_monome_t *monome);
+
+void r_monome_led_set(r_monome_t *monome, uint_t x, uint_t y, uint_t on);
+void r_monome_led_row(r_monome_t *monome, uint_t x_off, uint_t y, size_t count, const uint8_t *data);
+void r_monome_led_all(r_monome_t *monome, uint_t on);
+
 void r_monome_display_file(file_t *f);
 void r_monome_free(r_monome_t *monome);
+int  r_monome_init_offline();
 int  r_monome_init();
 
 #endif
@@ -0,0 +1,46 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_RTCHECK_H
+#define _ROVE_RTCHECK_H
+
+/**
+ * built with --rt-check, rove interposes the allocator, mutex locking
+ * and the write/sendto syscalls, and complains about any call made
+ * between rtcheck_enter() and rtcheck_leave() on the same thread.  the
+ * drivers wrap each engine cycle in those, and rtcheck_report() prints
+ * whatever got caught along with a backtrace.
+ *
+ * without --rt-check these are empty.
+ */
+
+#ifdef ROVE_RT_CHECK
+
+void rtcheck_enter();
+void rtcheck_leave();
+int rtcheck_report();
+
+#else
+
+static inline void rtcheck_enter() {}
+static inline void rtcheck_leave() {}
+static inline int rtcheck_report() { return 0; }
+
+#endif
+
+#endif
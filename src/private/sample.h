@@ -0,0 +1,47 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_SAMPLE_H
+#define _ROVE_SAMPLE_H
+
+#include <stddef.h>
+
+/**
+ * memory for sample data.  everything handed out here is paged in
+ * before it's returned and, within the budget set by "lock" in the
+ * [memory] section of the conf file, mlock()ed, so that the JACK thread
+ * never takes a page fault the first time it plays a loop.
+ */
+
+typedef enum {
+	SAMPLE_HUGEPAGES_OFF,
+	SAMPLE_HUGEPAGES_TRANSPARENT,
+	SAMPLE_HUGEPAGES_EXPLICIT
+} sample_hugepages_t;
+
+void *sample_alloc(size_t size);
+void sample_free(void *data, size_t size);
+
+/* for memory that's already mapped and populated (bundles) */
+void sample_lock(void *data, size_t size);
+
+size_t sample_total();
+size_t sample_locked();
+void sample_report();
+
+#endif
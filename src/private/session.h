@@ -18,11 +18,15 @@
 
 #include "types.h"
 
+/* a group that follows the session's quantize setting */
+#define SESSION_QUANTIZE_INHERIT -1.0
+
 int session_next();
 int session_prev();
 void session_activate(session_t *);
 
 session_t *session_new(const char *path);
+int session_group_quantize_new(session_t *);
 void session_free(session_t *);
 
 int session_load(const char *path);
@@ -0,0 +1,43 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_STATS_H
+#define _ROVE_STATS_H
+
+#include <stdint.h>
+
+#include "engine.h"
+
+/**
+ * runtime metrics.  everything that gets called from the JACK thread
+ * only touches atomics, and the socket is served from its own thread.
+ * the min/avg/p99/max of the process callback cover the time since the
+ * last scrape, everything else counts up from startup.
+ */
+
+void stats_cycle(const engine_cycle_t *cycle, uint64_t ns);
+void stats_xrun();
+
+void stats_display_frame();
+void stats_osc_in();
+void stats_osc_out();
+
+int stats_serve(const char *path);
+void stats_stop();
+
+#endif
@@ -0,0 +1,42 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_THREADS_H
+#define _ROVE_THREADS_H
+
+#include <pthread.h>
+
+#include "types.h"
+
+/**
+ * scheduling for rove's own threads, set from the [input] and [display]
+ * sections of the conf file:
+ *
+ *   policy   = fifo, rr, other, batch or idle
+ *   priority = 1-99 for fifo and rr.  zero or less is relative to
+ *              JACK's realtime priority, so -1 is "just below JACK".
+ *   cpus     = 0,2-3 (or "all")
+ */
+
+int threads_parse_policy(const char *str);
+int threads_parse_cpus(const char *str, unsigned long *mask);
+
+int threads_apply(pthread_t thread, const thread_config_t *config, const char *name);
+int threads_lock_memory();
+
+#endif
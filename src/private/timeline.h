@@ -0,0 +1,104 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_TIMELINE_H
+#define _ROVE_TIMELINE_H
+
+#include <stdint.h>
+
+#include "engine.h"
+#include "types.h"
+
+/**
+ * a timeline is a plain text list of grid and MIDI events, one per line:
+ *
+ *   # comment
+ *   period 256          (optional, frames per engine cycle)
+ *   rate   48000        (optional, sample rate)
+ *   48000 3 1 down      (frame x y down|up [target])
+ *   48000 3 1 up
+ *   48256 5 2 down 48391
+ *   50011 2 1 note      (a MIDI note cutting in at x y)
+ *   50100 0 2 volume 0.5  (MIDI setting group y's volume, x is unused)
+ *   end    480000       (optional, last frame to render)
+ *
+ * events are sorted by frame as they're loaded, keeping the ones on the
+ * same frame in the order they were written.  a grid event is delivered
+ * right before the engine cycle its frame falls in, stamped with that
+ * frame: everything it does is acted on from the first cycle starting at
+ * or after it, quantized requests on the grid from there.  an
+ * unquantized cut lands on its target, which is where the live log puts
+ * the frame the cut actually landed on; without one it lands on the
+ * event's frame.  MIDI events are handed to the engine as timed input
+ * for the cycle their frame falls in, the way the JACK driver does it.
+ */
+
+/* what else an event can be, besides MONOME_BUTTON_DOWN or _UP */
+enum {
+	TIMELINE_MIDI_CUT = 0x100,
+	TIMELINE_MIDI_VOLUME
+};
+
+typedef struct timeline_event timeline_event_t;
+typedef struct timeline timeline_t;
+
+struct timeline_event {
+	uint64_t frame;
+	uint64_t target;
+
+	uint_t x;
+	uint_t y;
+	uint_t type;
+	double value;
+};
+
+struct timeline {
+	timeline_event_t *events;
+	int count;
+	int size;
+
+	/* zero if the timeline didn't say */
+	uint64_t end;
+	jack_nframes_t period;
+	jack_nframes_t rate;
+};
+
+timeline_t *timeline_load(const char *path);
+void timeline_free(timeline_t *self);
+
+/* the frame to stop rendering at, a few seconds past the last event if
+   the timeline didn't give one */
+uint64_t timeline_end(const timeline_t *self, jack_nframes_t rate);
+
+/* whether an event is MIDI, and what the driver would have handed the
+   engine for it in the cycle starting at start */
+int timeline_is_midi(const timeline_event_t *self);
+void timeline_engine_event(const timeline_event_t *self, uint64_t start, engine_event_t *e);
+
+/* live event log, written in the same format so it can be rendered */
+int timeline_log_open(const char *path, jack_nframes_t period, jack_nframes_t rate);
+
+/* target is ENGINE_NO_TARGET if the event didn't cut anywhere else */
+void timeline_log_event(uint64_t frame, uint64_t target, uint_t x, uint_t y, uint_t type);
+
+/* from the audio thread, with the cycle that's just been run */
+void timeline_log_midi(const engine_cycle_t *cycle);
+
+void timeline_log_close(uint64_t end);
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_TRACE_H
+#define _ROVE_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * each thread that calls trace_thread() gets its own ring of fixed-size
+ * records, so writing one is a couple of stores and no locks.  the rings
+ * hold the most recent TRACE_RING_SIZE records per thread and are only
+ * read when someone sends us SIGUSR1, at which point a low-priority
+ * thread writes them out as chrome trace JSON (chrome://tracing or
+ * ui.perfetto.dev will open it).
+ */
+
+typedef enum {
+	TRACE_PROCESS,
+	TRACE_QUANTIZE,
+	TRACE_SEEK,
+	TRACE_PATTERN_STEP,
+	TRACE_INPUT,
+	TRACE_LED,
+	TRACE_DISPLAY,
+	TRACE_SESSION
+} trace_event_t;
+
+int trace_init(const char *dir);
+void trace_thread(const char *name);
+
+void trace_begin(trace_event_t event, uint32_t arg);
+void trace_end(trace_event_t event, uint32_t arg);
+void trace_instant(trace_event_t event, uint32_t arg);
+
+#endif
@@ -21,6 +21,7 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <semaphore.h>
 
 #include <monome.h>
 #include <jack/jack.h>
@@ -37,6 +38,9 @@
 #define PATTERN_T(x) ((pattern_t *) x)
 #define PATTERN_STEP_T(x) ((pattern_step_t *) x)
 
+/* enough for third order ambisonics */
+#define GROUP_MAX_CHANNELS 16
+
 /**
  * types
  */
@@ -64,8 +68,25 @@ typedef enum {
 	PATTERN_STATUS_INACTIVE
 } pattern_status_t;
 
+typedef enum {
+	CAPTURE_EMPTY,      /* nothing recorded yet */
+	CAPTURE_ARMED,      /* waiting for the group's next boundary */
+	CAPTURE_RECORDING,
+	CAPTURE_SAVING,     /* looping while the writer thread saves it */
+	CAPTURE_READY
+} capture_state_t;
+
+/* the rungs of the quality ladder varispeed loops play at, see quality.h */
+typedef enum {
+	QUALITY_SINC,
+	QUALITY_CUBIC,
+	QUALITY_LINEAR
+} quality_t;
+
 typedef struct group group_t;
 typedef struct file file_t;
+typedef struct voice voice_t;
+typedef struct capture capture_t;
 
 typedef struct pattern pattern_t;
 typedef struct pattern_step pattern_step_t;
@@ -75,11 +96,12 @@ typedef struct r_monome_position r_monome_position_t;
 typedef struct r_monome r_monome_t;
 
 typedef struct session session_t;
+typedef struct thread_config thread_config_t;
 typedef struct state state_t;
 
 typedef void (*r_monome_callback_t)(r_monome_t *, uint_t x, uint_t y, uint_t event_type, void *user_arg);
 
-typedef void (*process_callback_t)(file_t *self, jack_default_audio_sample_t **buffers, int channels, jack_nframes_t nframes, jack_nframes_t sample_rate);
+typedef void (*process_callback_t)(voice_t *self, group_t *group, jack_default_audio_sample_t **buffers, jack_nframes_t nframes, jack_nframes_t sample_rate);
 typedef void (*quantize_callback_t)(file_t *self);
 typedef void (*r_monome_output_callback_t)(file_t *self, r_monome_t *);
 
@@ -113,6 +135,54 @@ struct r_monome {
 	int mod_keys;
 	int rows;
 	int cols;
+
+	/* a row with nothing on it that's being held down, zero if none, and
+	   the column it's held at */
+	int held_row;
+	int held_col;
+
+	/* each pattern button's light (by pattern index), set by the
+	   engine for the display thread to show: on, off, or if negative,
+	   blinking every so many frames.  and what the display last sent. */
+	int pattern_lights[2];
+	int pattern_lights_shown[2];
+
+	/* the display thread waits on display_wake while there's nothing to
+	   show, with display_parked set so that anything that changes that
+	   knows to post it (r_monome_wake_display()) */
+	sem_t display_wake;
+	int display_parked;
+};
+
+/**
+ * voice
+ */
+
+/* the part of a loop the engine plays from, kept apart from the rest of
+   file_t so that a block only has to touch a line or two of it for each
+   group.  voices are handed out from contiguous blocks, see voice.h. */
+struct voice {
+	process_callback_t process_cb;
+	float *file_data;
+
+	sf_count_t play_offset;
+	sf_count_t file_length;
+
+	double volume;
+	double speed;
+
+	int channels;
+	file_play_direction_t play_direction;
+	jack_nframes_t sample_rate;
+
+#ifdef HAVE_SRC
+	SRC_STATE *src;
+
+	/* the quality_t this loop last played at, and for the rungs below
+	   sinc, how far it is between the play position and the next frame */
+	int src_quality;
+	double src_phase;
+#endif
 };
 
 /**
@@ -122,25 +192,16 @@ struct r_monome {
 struct file {
 	char *path;
 
-	file_play_direction_t play_direction;
 	file_status_t status;
-
-	double volume;
+	voice_t *voice;
 
 	sf_count_t length;
-	sf_count_t play_offset;
 	sf_count_t new_offset;
 
-	sf_count_t channels;
-	sf_count_t file_length;
-	sf_count_t sample_rate;
-
-#ifdef HAVE_SRC	
-	SRC_STATE *src;
-#endif
-	double speed;
-
-	float *file_data;
+	/* set if file_data points into memory we don't own (e.g. a
+	   mapped bundle) and mustn't be freed along with the file */
+	int file_data_borrowed;
+	size_t file_data_size;
 
 	int y;
 	int row_span;
@@ -157,10 +218,51 @@ struct file {
 
 	group_t *group;
 
-	process_callback_t process_cb;
+	/* engine frame and grid event the pending quantize_cb was
+	   requested at, and whether it should run at the start of the next
+	   cycle rather than on a quantize boundary. */
+	uint64_t quantize_frame;
+	uint_t quantize_event;
+	int quantize_immediate;
+
+	/* with quantizing off, the frame the callback should run at
+	   (ENGINE_NO_TARGET otherwise) */
+	uint64_t quantize_target;
+
+	/* for the latency histograms: when the grid event arrived (zero
+	   if it didn't come from the grid) and the first cycle that could
+	   have acted on it */
+	uint64_t quantize_arrival;
+	uint64_t quantize_seen;
+
 	quantize_callback_t quantize_cb;
 	r_monome_output_callback_t monome_out_cb;
 	r_monome_callback_t monome_in_cb;
+
+	/* set if this is a slot for recording into rather than a loop
+	   loaded from disk */
+	capture_t *capture;
+};
+
+struct capture {
+	double beats;
+	double bpm;         /* of the session the slot is in */
+	char *dirname;      /* ...and where takes get saved */
+
+	sf_count_t frames;  /* the length of a take, once the rate is known */
+	sf_count_t recorded;
+
+	/* capture_state_t.  armed by the input thread, recording and
+	   saving by the engine, ready again by the writer thread. */
+	int state;
+
+	int held;           /* buttons held down on the slot */
+	int takes;
+
+	/* for a bounce: the groups to record instead of capture_in, and
+	   the pattern that's replaced once the take is done */
+	uint32_t groups;
+	pattern_t *pattern;
 };
 
 /**
@@ -171,15 +273,45 @@ struct group {
 	int idx;
 	file_t *active_loop;
 
-	double volume;
-
-	/* eventually this will be an array of ports so that any arbitrary
-	   number of channels can be output (rove cutting 5.1 audio, yeah!) */
-	jack_port_t *outport_l;
-	jack_port_t *outport_r;
+	/* active_loop's voice, which is all the engine looks at to play it */
+	voice_t *voice;
 
-	jack_default_audio_sample_t *output_buffer_l;
-	jack_default_audio_sample_t *output_buffer_r;
+	/* where the volume is headed, set from any thread (group_set_volume()).
+	   the engine owns the rest: the gain the current ramp started from,
+	   how far it moves each frame, how many frames of the ramp have
+	   played and the gain_left frames until it gets to gain_target. */
+	double volume;
+	double gain_target;
+	float gain;
+	float gain_step;
+	jack_nframes_t gain_at;
+	jack_nframes_t gain_left;
+
+	/* set by the engine for a block where a bounce is recording this
+	   group: the voice plays at unity and the gain goes on afterwards */
+	int unity;
+
+	/* this group's quantize grid: frames between boundaries and frames
+	   since the last one.  unquantized groups cut on the exact frame. */
+	jack_nframes_t snap_delay;
+	jack_nframes_t quantize_frames;
+	int unquantized;
+
+	/* only touched by the engine: whether the grid is on a boundary
+	   right now, and whether a request is waiting on it */
+	int quantize_due;
+	int quantize_pending;
+
+	/* how many frames at the start of the output buffers the engine has
+	   left holding silence, so that a quiet group can leave them be next
+	   cycle.  whoever hands the group different buffers zeroes it. */
+	jack_nframes_t silent;
+
+	/* one port and one buffer per channel, so any number of channels
+	   can be output (rove cutting 5.1 audio, yeah!) */
+	int channels;
+	jack_port_t *outports[GROUP_MAX_CHANNELS];
+	jack_default_audio_sample_t *output_buffers[GROUP_MAX_CHANNELS];
 };
 
 /**
@@ -196,6 +328,9 @@ struct pattern {
 	pattern_step_t *current_step;
 
 	int step_delay;
+
+	/* the capture slot this pattern is being bounced into */
+	file_t *bounce;
 };
 
 struct pattern_step {
@@ -226,6 +361,11 @@ struct session {
 	double bpm;
 	double beat_multiplier;
 
+	/* per-group quantize settings from [group] sections, one for each
+	   group (SESSION_QUANTIZE_INHERIT where the session's applies), or
+	   NULL if there weren't any */
+	double *group_quantize;
+
 	int pattern_lengths[2];
 };
 
@@ -233,18 +373,61 @@ struct session {
  * rove
  */
 
+struct thread_config {
+	int set;
+
+	int policy;          /* -1 to leave it alone */
+	int priority;
+	unsigned long cpus;  /* bitmask, zero to leave it alone */
+};
+
 struct state {
 	struct {
 		char *osc_prefix;
 		char *osc_host_port;
 		char *osc_listen_port;
 
+		char *stats_socket;
+
+		long lock_budget;  /* megabytes of sample data to mlock() */
+		int hugepages;     /* sample_hugepages_t */
+		int mlockall;
+
+		thread_config_t input_thread;
+		thread_config_t display_thread;
+
+		struct {
+			int channel;  /* 1-16, or zero for all of them */
+			int note;     /* the note that cuts row 1, column 0 */
+			int columns;  /* notes per row, zero for the grid's width */
+			int cc;       /* controller for group 1's volume, zero for none */
+		} midi;
+
+		struct {
+			int groups;   /* record each group as well as the master mix */
+			long buffer;  /* seconds of audio each ring buffer holds */
+		} record;
+
+		struct {
+			int floor;    /* the lowest quality_t to step down to */
+			int high;     /* percent of a period that's too much load */
+			int low;      /* ...and that's little enough to step back up */
+		} quality;
+
 		int cols;
 		int rows;
 	} config;
 
 	r_monome_t *monome;
 	jack_client_t *client;
+	jack_nframes_t sample_rate;
+
+	/* set while JACK runs us in freewheel mode, with no deadline and
+	   nobody watching the grid */
+	int freewheeling;
+
+	/* the quality_t varispeed loops are playing at right now */
+	int quality;
 
 	int group_count;
 	group_t *groups;
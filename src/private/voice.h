@@ -0,0 +1,45 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_VOICE_H
+#define _ROVE_VOICE_H
+
+#include <sndfile.h>
+
+#include "types.h"
+
+/* voices per block, and what each block is aligned to (a cache line) */
+#define VOICE_BLOCK 64
+#define VOICE_ALIGN 64
+
+#define voice_get_play_pos(v) ((v)->play_offset * (v)->channels)
+
+/**
+ * voices come out of blocks of VOICE_BLOCK, handed out in order, so the
+ * loops in a session sit next to each other.  a block never moves once
+ * it's been allocated, which lets the engine keep pointers into it while
+ * the input thread makes new loops (pattern bounces, see capture.h).
+ * only one thread at a time should be getting and giving back voices.
+ */
+voice_t *voice_new(process_callback_t process_cb);
+void voice_free(voice_t *self);
+
+void voice_set_play_pos(voice_t *self, sf_count_t pos);
+void voice_inc_play_pos(voice_t *self, sf_count_t delta);
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROVE_XRUN_H
+#define _ROVE_XRUN_H
+
+#include <stdint.h>
+
+#include "engine.h"
+
+/**
+ * keeps the last XRUN_HISTORY cycles of engine state around so that
+ * when JACK tells us about an xrun we can write out what led up to it.
+ */
+
+int xrun_init(const char *dir);
+
+void xrun_cycle(const engine_cycle_t *cycle, uint64_t ns);
+void xrun_snapshot();
+
+#endif
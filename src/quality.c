@@ -0,0 +1,152 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <jack/jack.h>
+
+#include "quality.h"
+#include "types.h"
+#include "util.h"
+
+/* cycles the load is averaged over, and how many go by after a step
+   before the average is trusted again */
+#define QUALITY_SMOOTHING 16
+#define QUALITY_SETTLE    (QUALITY_SMOOTHING * 2)
+
+/* seconds the load has to stay low before stepping back up.  a step up
+   that's followed by a step down within that time doubles it, and it
+   goes back to the start once everything has stayed at the top for
+   the longest of those. */
+#define QUALITY_RECOVER     2.0
+#define QUALITY_RECOVER_MAX 64.0
+
+extern state_t state;
+
+static const char *names[] = {"sinc", "cubic", "linear"};
+
+static int enabled = 0;
+
+/* all of this belongs to the JACK thread */
+static double load = 0;  /* percent of a period, averaged */
+static int settle = 0;
+static uint64_t calm = 0;
+static uint64_t since_up = UINT64_MAX;
+static double recover = QUALITY_RECOVER;
+
+/* the load at the last step, for the log thread */
+static double step_load;
+static sem_t log_sem;
+static pthread_t log_thread;
+
+const char *quality_name(int quality) {
+	return names[quality];
+}
+
+static void step(int quality) {
+	__atomic_store(&step_load, &load, __ATOMIC_RELAXED);
+	__atomic_store_n(&state.quality, quality, __ATOMIC_RELEASE);
+
+	settle = QUALITY_SETTLE;
+	calm   = 0;
+
+	sem_post(&log_sem);
+}
+
+void quality_cycle(uint64_t ns, jack_nframes_t nframes, jack_nframes_t rate) {
+	uint64_t cycles_per_sec;
+
+	if( !enabled )
+		return;
+
+	/* nobody's waiting on a freewheeling render, so it gets the best */
+	if( __atomic_load_n(&state.freewheeling, __ATOMIC_RELAXED) ) {
+		if( state.quality != QUALITY_SINC )
+			step(QUALITY_SINC);
+
+		return;
+	}
+
+	load += (100.0 * ns * rate / (nframes * 1000000000.0) - load) / QUALITY_SMOOTHING;
+	cycles_per_sec = MAX(rate / nframes, 1);
+
+	if( since_up < UINT64_MAX && ++since_up > QUALITY_RECOVER_MAX * cycles_per_sec
+	    && state.quality == QUALITY_SINC ) {
+		recover  = QUALITY_RECOVER;
+		since_up = UINT64_MAX;
+	}
+
+	if( settle ) {
+		settle--;
+		return;
+	}
+
+	if( load > state.config.quality.high && state.quality < state.config.quality.floor ) {
+		if( since_up < recover * cycles_per_sec && (recover *= 2) > QUALITY_RECOVER_MAX )
+			recover = QUALITY_RECOVER_MAX;
+
+		since_up = UINT64_MAX;
+		step(state.quality + 1);
+	} else if( load < state.config.quality.low && state.quality > QUALITY_SINC ) {
+		if( ++calm < recover * cycles_per_sec )
+			return;
+
+		since_up = 0;
+		step(state.quality - 1);
+	} else
+		calm = 0;
+}
+
+static void *log_loop(void *user_data) {
+	int quality, last = QUALITY_SINC;
+	double l;
+
+	for(;;) {
+		while( sem_wait(&log_sem) );
+
+		quality = __atomic_load_n(&state.quality, __ATOMIC_ACQUIRE);
+		__atomic_load(&step_load, &l, __ATOMIC_RELAXED);
+
+		if( quality == last )
+			continue;
+
+		printf("quality: engine at %.0f%% of a period, varispeed loops %s to %s\n",
+		       l, ( quality > last ) ? "down" : "back up", names[quality]);
+		last = quality;
+	}
+
+	return NULL;
+}
+
+int quality_init() {
+	if( state.config.quality.floor == QUALITY_SINC )
+		return 0;
+
+	sem_init(&log_sem, 0, 0);
+
+	if( pthread_create(&log_thread, NULL, log_loop, NULL) ) {
+		fprintf(stderr, "quality: couldn't start the log thread, aieee!\n");
+		return 1;
+	}
+
+	enabled = 1;
+	return 0;
+}
@@ -0,0 +1,298 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+#include <sndfile.h>
+
+#include "recorder.h"
+#include "types.h"
+
+/* how often the writer thread empties the rings */
+#define WRITER_INTERVAL_MS 50
+
+extern state_t state;
+
+typedef struct {
+	jack_ringbuffer_t *ring;
+	SNDFILE *snd;
+	char *path;
+
+	/* recorded interleaved, as many channels as the source has */
+	int channels;
+	size_t frame_size;
+
+	uint64_t written;
+	uint64_t dropped;  /* atomic, bumped by the JACK thread */
+} stream_t;
+
+/* the master mix first, then one per group */
+static stream_t *streams = NULL;
+static int stream_count = 0;
+
+static pthread_t writer_thread;
+static int stopping = 0;
+
+static void write_stream(stream_t *s, const jack_default_audio_sample_t *const *bufs,
+                         jack_nframes_t nframes) {
+	struct timespec wait = {0, 1000000};
+	jack_ringbuffer_data_t vec[2];
+	jack_nframes_t i;
+	float *d, *end;
+	int k;
+
+	while( jack_ringbuffer_write_space(s->ring) < nframes * s->frame_size ) {
+		/* with no deadline to meet, waiting for the disk beats
+		   losing audio */
+		if( !__atomic_load_n(&state.freewheeling, __ATOMIC_RELAXED) ) {
+			__atomic_fetch_add(&s->dropped, nframes, __ATOMIC_RELAXED);
+			return;
+		}
+
+		nanosleep(&wait, NULL);
+	}
+
+	/* interleave straight into the ring, which might wrap partway
+	   (even partway through a frame, but never through a sample) */
+	jack_ringbuffer_get_write_vector(s->ring, vec);
+
+	d   = (float *) vec[0].buf;
+	end = d + vec[0].len / sizeof(float);
+
+	for( i = 0; i < nframes; i++ )
+		for( k = 0; k < s->channels; k++ ) {
+			if( d == end )
+				d = (float *) vec[1].buf;
+
+			*d++ = bufs[k][i];
+		}
+
+	jack_ringbuffer_write_advance(s->ring, nframes * s->frame_size);
+}
+
+void recorder_process(const jack_default_audio_sample_t *master_l,
+                      const jack_default_audio_sample_t *master_r, jack_nframes_t nframes) {
+	const jack_default_audio_sample_t *master[2] = {master_l, master_r};
+	group_t *g;
+	int i;
+
+	if( !streams )
+		return;
+
+	write_stream(&streams[0], master, nframes);
+
+	for( i = 1; i < stream_count; i++ ) {
+		g = &state.groups[i - 1];
+		write_stream(&streams[i], (const jack_default_audio_sample_t *const *) g->output_buffers, nframes);
+	}
+}
+
+static void write_frames(stream_t *s, const float *buf, sf_count_t frames) {
+	if( !frames )
+		return;
+
+	/* on a write error the audio is lost either way, so keep the ring
+	   moving rather than letting it fill up */
+	if( sf_writef_float(s->snd, buf, frames) != frames )
+		fprintf(stderr, "record: error writing %s: %s\n", s->path, sf_strerror(s->snd));
+
+	jack_ringbuffer_read_advance(s->ring, frames * s->frame_size);
+	s->written += frames;
+}
+
+static void drain(stream_t *s) {
+	float frame[GROUP_MAX_CHANNELS];
+	jack_ringbuffer_data_t vec[2];
+	size_t split;
+
+	jack_ringbuffer_get_read_vector(s->ring, vec);
+
+	write_frames(s, (float *) vec[0].buf, vec[0].len / s->frame_size);
+
+	/* a frame that wraps around the end of the ring gets put back
+	   together before it's written */
+	if( (split = vec[0].len % s->frame_size) && vec[1].len >= s->frame_size - split ) {
+		memcpy(frame, vec[0].buf + vec[0].len - split, split);
+		memcpy((char *) frame + split, vec[1].buf, s->frame_size - split);
+		write_frames(s, frame, 1);
+
+		vec[1].buf += s->frame_size - split;
+		vec[1].len -= s->frame_size - split;
+	}
+
+	write_frames(s, (float *) vec[1].buf, vec[1].len / s->frame_size);
+}
+
+static void *writer_loop(void *user_data) {
+	struct timespec req;
+	int i, stop;
+
+	req.tv_sec  = 0;
+	req.tv_nsec = WRITER_INTERVAL_MS * 1000000;
+
+	do {
+		nanosleep(&req, NULL);
+
+		/* JACK is deactivated before we're told to stop, so one more
+		   pass gets everything */
+		stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+
+		for( i = 0; i < stream_count; i++ )
+			drain(&streams[i]);
+	} while( !stop );
+
+	return NULL;
+}
+
+static int format_for(const char *path) {
+	const char *ext = strrchr(path, '.');
+
+	if( ext && !strcasecmp(ext, ".flac") )
+		return SF_FORMAT_FLAC | SF_FORMAT_PCM_24;
+
+	return SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+}
+
+/* "set.wav" becomes "set-group1.wav" */
+static char *group_path(const char *path, int group) {
+	const char *ext, *slash;
+	char *buf;
+
+	ext   = strrchr(path, '.');
+	slash = strrchr(path, '/');
+
+	if( !ext || (slash && ext < slash) )
+		ext = path + strlen(path);
+
+	if( asprintf(&buf, "%.*s-group%d%s", (int) (ext - path), path, group, ext) < 0 )
+		return NULL;
+
+	return buf;
+}
+
+static int open_stream(stream_t *s, char *path, int channels, jack_nframes_t sample_rate) {
+	SF_INFO info;
+
+	if( !(s->path = path) ) {
+		fprintf(stderr, "record: couldn't allocate string buffer, aieee!\n");
+		return 1;
+	}
+
+	s->channels   = channels;
+	s->frame_size = channels * sizeof(float);
+
+	memset(&info, 0, sizeof(info));
+	info.samplerate = sample_rate;
+	info.channels   = channels;
+	info.format     = format_for(path);
+
+	if( !(s->snd = sf_open(path, SFM_WRITE, &info)) ) {
+		fprintf(stderr, "record: couldn't open %s for writing: %s\n", path, sf_strerror(NULL));
+		return 1;
+	}
+
+	if( !(s->ring = jack_ringbuffer_create(state.config.record.buffer * sample_rate * s->frame_size)) ) {
+		fprintf(stderr, "record: couldn't allocate ring buffer, aieee!\n");
+		return 1;
+	}
+
+	/* the JACK thread writes to every page of it */
+	jack_ringbuffer_mlock(s->ring);
+
+	return 0;
+}
+
+int recorder_start(const char *path, jack_nframes_t sample_rate) {
+	stream_t *s;
+	int i;
+
+	stream_count = 1 + (( state.config.record.groups ) ? state.group_count : 0);
+
+	if( !(s = calloc(sizeof(stream_t), stream_count)) ) {
+		fprintf(stderr, "record: couldn't allocate streams, aieee!\n");
+		return 1;
+	}
+
+	if( open_stream(&s[0], strdup(path), 2, sample_rate) )
+		return 1;
+
+	for( i = 1; i < stream_count; i++ )
+		if( open_stream(&s[i], group_path(path, i), state.groups[i - 1].channels, sample_rate) )
+			return 1;
+
+	streams = s;
+
+	if( pthread_create(&writer_thread, NULL, writer_loop, NULL) ) {
+		fprintf(stderr, "record: couldn't start the writer thread, aieee!\n");
+		streams = NULL;
+		return 1;
+	}
+
+	printf("record: recording to %s", path);
+	if( stream_count > 1 )
+		printf(" (and %d groups alongside it)", stream_count - 1);
+	printf("\n");
+
+	return 0;
+}
+
+void recorder_stop() {
+	stream_t *s;
+	int i;
+
+	if( !streams )
+		return;
+
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(writer_thread, NULL);
+
+	for( i = 0; i < stream_count; i++ ) {
+		s = &streams[i];
+		sf_close(s->snd);
+
+		printf("record: wrote %.1f s to %s", s->written / (double) state.sample_rate, s->path);
+		if( s->dropped )
+			printf(", dropped %" PRIu64 " frames (raise \"buffer\" under [record])", s->dropped);
+		printf("\n");
+	}
+
+	streams = NULL;
+}
+
+uint64_t recorder_dropped() {
+	uint64_t dropped;
+	stream_t *s;
+	int i;
+
+	if( !(s = streams) )
+		return 0;
+
+	for( i = dropped = 0; i < stream_count; i++ )
+		dropped += __atomic_load_n(&s[i].dropped, __ATOMIC_RELAXED);
+
+	return dropped;
+}
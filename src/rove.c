@@ -28,13 +28,26 @@
 #include "config_parser.h"
 
 #include "rove.h"
+#include "bundle.h"
+#include "capture.h"
+#include "engine.h"
+#include "offline.h"
+#include "quality.h"
 #include "file.h"
 #include "jack.h"
 #include "list.h"
+#include "recorder.h"
 #include "rmonome.h"
 #include "util.h"
 #include "session.h"
+#include "rtcheck.h"
+#include "sample.h"
 #include "settings.h"
+#include "stats.h"
+#include "threads.h"
+#include "trace.h"
+#include "xrun.h"
+#include "timeline.h"
 
 
 #define DEFAULT_CONF_FILE_NAME  ".rove.conf"
@@ -46,6 +59,12 @@
 #define DEFAULT_OSC_HOST_PORT   "8080"
 #define DEFAULT_OSC_LISTEN_PORT "8000"
 
+#define DEFAULT_SAMPLE_RATE 48000
+
+#define DEFAULT_MIDI_NOTE 36   /* C1, where most pad controllers start */
+
+#define DEFAULT_RECORD_BUFFER 10  /* seconds */
+
 
 state_t state;
 
@@ -72,17 +91,89 @@ void usage() {
 		   "\n"
 		   "  -p, --osc-prefix=PREFIX\n"
 		   "  -h, --osc-host-port=PORT\n"
-		   "  -l, --osc-listen-port=PORT\n\n");
+		   "  -l, --osc-listen-port=PORT\n"
+		   "\n"
+		   "      --compile           compile the sessions into a bundle and exit\n"
+		   "      --render=TIMELINE   play a timeline of grid events through the\n"
+		   "                          engine offline (no JACK or monome) and exit\n"
+		   "      --freewheel         ...or through JACK in freewheel mode\n"
+		   "  -o, --output=FILE       bundle or sound file to write\n"
+		   "  -R, --sample-rate=RATE  rate to compile or render at (default %d)\n"
+		   "      --period=FRAMES     frames per engine cycle when rendering\n"
+		   "      --log-events=FILE   record grid events to FILE as a timeline\n"
+		   "                          that --render can play back\n"
+		   "      --stats-socket=PATH serve runtime metrics on a unix socket\n"
+		   "      --trace-dir=DIR     keep a trace of what each thread is doing and\n"
+		   "                          write it to DIR on SIGUSR1\n"
+		   "      --xrun-dir=DIR      write the last few hundred cycles to DIR\n"
+		   "                          whenever JACK reports an xrun\n"
+		   "      --record=FILE       record the master mix to FILE (.wav or .flac)\n\n",
+		   DEFAULT_SAMPLE_RATE);
 }
 
-static void monome_display_loop() {
+/**
+ * with nothing playing, nothing waiting on a boundary, no patterns and
+ * no LEDs left to update, there's nothing for the display to do until
+ * somebody presses something.
+ */
+static int display_idle(r_monome_t *monome) {
+	int j;
+
+	if( state.pattern_rec || !list_is_empty(state.patterns) )
+		return 0;
+
+	if( monome->quantize_field >> 1 || monome->dirty_field >> 1 )
+		return 0;
+
+	for( j = 0; j < 2; j++ )
+		if( __atomic_load_n(&monome->pattern_lights[j], __ATOMIC_ACQUIRE)
+		    != monome->pattern_lights_shown[j] )
+			return 0;
+
+	for( j = 0; j < state.group_count; j++ )
+		if( state.groups[j].active_loop )
+			return 0;
+
+	return 1;
+}
+
+static void display_park(r_monome_t *monome) {
+	/* raise the flag before looking, so anything that changes after we
+	   look is sure to wake us (see r_monome_wake_display()) */
+	__atomic_store_n(&monome->display_parked, 1, __ATOMIC_SEQ_CST);
+
+	if( !display_idle(monome) ) {
+		/* if somebody took the flag down, they've posted too */
+		if( __atomic_exchange_n(&monome->display_parked, 0, __ATOMIC_SEQ_CST) )
+			return;
+	}
+
+	while( sem_wait(&monome->display_wake) );
+}
+
+static void pattern_lights(r_monome_t *monome) {
 	static int pblnk = 0;
+	int idx, light, x;
+
+	for( idx = 0; idx < 2; idx++ ) {
+		light = __atomic_load_n(&monome->pattern_lights[idx], __ATOMIC_ACQUIRE);
+		x = monome->cols - 4 + idx;
+
+		if( light < 0 )
+			r_monome_led_set(monome, x, 0,
+			                 ((pblnk = (pblnk + 1) % -light) < ((-light / 2) + 1)));
+		else if( light != monome->pattern_lights_shown[idx] )
+			r_monome_led_set(monome, x, 0, light);
 
+		monome->pattern_lights_shown[idx] = light;
+	}
+}
+
+static void monome_display_loop() {
 	int j, group_count, next_bit;
 	uint16_t dfield;
 
 	struct timespec req;
-	pattern_t *p;
 
 	r_monome_t *monome = state.monome;
 	group_t *g;
@@ -91,13 +182,13 @@ static void monome_display_loop() {
 	req.tv_sec  = 0;
 	req.tv_nsec = 1000000000 / 80; /* 80 fps */
 
+	trace_thread("display");
+
 	for(;;) {
+		trace_begin(TRACE_DISPLAY, 0);
 		group_count = state.group_count;
 
-		if( (p = state.pattern_rec) && p->step_delay )
-			monome_led_set(
-				p->monome->dev, p->monome->cols - 4 + p->idx, 0,
-				((pblnk = (pblnk + 1) % p->step_delay) < ((p->step_delay / 2) + 1)));
+		pattern_lights(monome);
 
 		for( j = 0; j < group_count; j++ ) {
 			g = &state.groups[j];
@@ -124,7 +215,12 @@ static void monome_display_loop() {
 				monome->dirty_field &= ~(1 << j);
 		}
 
+		trace_end(TRACE_DISPLAY, 0);
+		stats_display_frame();
 		nanosleep(&req, NULL);
+
+		if( display_idle(monome) )
+			display_park(monome);
 	}
 }
 
@@ -146,12 +242,19 @@ static void cleanup() {
 	r_monome_stop_thread(state.monome);
 	r_monome_free(state.monome);
 
+	stats_stop();
 	r_jack_deactivate();
+	recorder_stop();
+
+	/* after JACK, so that the last of the MIDI is in */
+	timeline_log_close(engine_next_frame());
+
+	rtcheck_report();
 }
 
 int main(int argc, char **argv) {
-	char *session_file, c;
-	int i;
+	char *session_file, *output_file, *timeline_file, *log_file, *record_file, c;
+	int i, compile, freewheel, sample_rate, period;
 
 	struct option arguments[] = {
 		{"help",			no_argument,       0, 'u'}, /* for "usage", get it?  hah, hah... */
@@ -160,15 +263,34 @@ int main(int argc, char **argv) {
 		{"osc-prefix", 		required_argument, 0, 'p'},
 		{"osc-host-port", 	required_argument, 0, 'h'},
 		{"osc-listen-port",	required_argument, 0, 'l'},
+		{"compile",			no_argument,       0, 'C'},
+		{"output",			required_argument, 0, 'o'},
+		{"sample-rate",		required_argument, 0, 'R'},
+		{"render",			required_argument, 0, 'T'},
+		{"freewheel",		no_argument,       0, 'F'},
+		{"period",			required_argument, 0, 'P'},
+		{"log-events",		required_argument, 0, 'L'},
+		{"stats-socket",	required_argument, 0, 'S'},
+		{"trace-dir",		required_argument, 0, 'D'},
+		{"xrun-dir",		required_argument, 0, 'X'},
+		{"record",			required_argument, 0, 'W'},
 		{0, 0, 0, 0}
 	};
 
 	memset(&state, 0, sizeof(state_t));
 
 	session_file = NULL;
+	output_file  = NULL;
+	timeline_file = NULL;
+	log_file      = NULL;
+	record_file   = NULL;
+	compile      = 0;
+	freewheel    = 0;
+	sample_rate  = 0;
+	period       = 0;
 	opterr = 0;
 
-	while( (c = getopt_long(argc, argv, "uc:r:p:h:l:", arguments, &i)) > 0 ) {
+	while( (c = getopt_long(argc, argv, "uc:r:p:h:l:o:R:", arguments, &i)) > 0 ) {
 		switch( c ) {
 		case 'u':
 			usage();
@@ -202,12 +324,87 @@ int main(int argc, char **argv) {
 
 			state.config.osc_listen_port = strdup(optarg);
 			break;
+
+		case 'C':
+			compile = 1;
+			break;
+
+		case 'o':
+			output_file = optarg;
+			break;
+
+		case 'R':
+			if( !is_numstr(optarg) || !(sample_rate = atoi(optarg)) )
+				usage_printf_exit("error: \"%s\" is not a valid sample rate.\n\n", optarg);
+
+			break;
+
+		case 'T':
+			timeline_file = optarg;
+			break;
+
+		case 'F':
+			freewheel = 1;
+			break;
+
+		case 'P':
+			if( !is_numstr(optarg) || !(period = atoi(optarg)) )
+				usage_printf_exit("error: \"%s\" is not a valid period size.\n\n", optarg);
+
+			break;
+
+		case 'L':
+			log_file = optarg;
+			break;
+
+		case 'S':
+			state.config.stats_socket = optarg;
+			break;
+
+		case 'D':
+			if( trace_init(optarg) )
+				exit(EXIT_FAILURE);
+
+			break;
+
+		case 'X':
+			if( xrun_init(optarg) )
+				exit(EXIT_FAILURE);
+
+			break;
+
+		case 'W':
+			record_file = optarg;
+			break;
 		}
 	}
 
+	if( compile && !output_file )
+		usage_printf_exit("error: --compile needs an output file (-o).\n\n");
+
+	if( freewheel && (!timeline_file || !output_file) )
+		usage_printf_exit("error: --freewheel needs a timeline (--render) and an output file (-o).\n\n");
+
+	state.config.midi.note = DEFAULT_MIDI_NOTE;
+
+	state.config.quality.floor = QUALITY_LINEAR;
+	state.config.quality.high  = DEFAULT_QUALITY_HIGH;
+	state.config.quality.low   = DEFAULT_QUALITY_LOW;
+
 	if( settings_load(user_config_path()) )
 		exit(EXIT_FAILURE);
 
+#define ASSIGN_IF_UNSET(k, v) do { \
+	if( !k ) \
+		k = v; \
+} while( 0 );
+
+	/* the grid size has to be known before loading sessions, since
+	   the number of groups depends on it. */
+	ASSIGN_IF_UNSET(state.config.cols, DEFAULT_MONOME_COLUMNS);
+	ASSIGN_IF_UNSET(state.config.rows, DEFAULT_MONOME_ROWS);
+	ASSIGN_IF_UNSET(state.config.record.buffer, DEFAULT_RECORD_BUFFER);
+
 	state.group_count = state.config.cols - 4;
 	state.patterns = list_new();
 	list_init(&state.sessions);
@@ -229,29 +426,59 @@ int main(int argc, char **argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	sample_report();
+
+	if( state.config.mlockall && !threads_lock_memory() )
+		printf("memory: everything locked (mlockall)\n");
+
+	if( compile ) {
+		if( !sample_rate )
+			sample_rate = DEFAULT_SAMPLE_RATE;
+
+		printf("\ncompiling yr sessions at %d Hz:\n", sample_rate);
+		exit(( bundle_compile(output_file, sample_rate) ) ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	if( timeline_file && !freewheel )
+		exit(( offline_render(timeline_file, output_file, period, sample_rate) )
+		     ? EXIT_FAILURE : EXIT_SUCCESS);
+
 	if( r_jack_init() ) {
 		fprintf(stderr, "error initializing JACK :(\n");
 		exit(EXIT_FAILURE);
 	}
 
-#define ASSIGN_IF_UNSET(k, v) do { \
-	if( !k ) \
-		k = v; \
-} while( 0 );
+	/* capture buffers are sized in frames, so this has to wait for
+	   the sample rate */
+	if( capture_prepare(state.sample_rate) )
+		exit(EXIT_FAILURE);
 
 	ASSIGN_IF_UNSET(state.config.osc_prefix, DEFAULT_OSC_PREFIX);
 	ASSIGN_IF_UNSET(state.config.osc_host_port, DEFAULT_OSC_HOST_PORT);
 	ASSIGN_IF_UNSET(state.config.osc_listen_port, DEFAULT_OSC_LISTEN_PORT);
-	ASSIGN_IF_UNSET(state.config.cols, DEFAULT_MONOME_COLUMNS);
-	ASSIGN_IF_UNSET(state.config.rows, DEFAULT_MONOME_ROWS);
 
 #undef ASSIGN_IF_UNSET
 
 	session_activate(SESSION_T(state.sessions.head.next));
 
+	if( freewheel )
+		exit(( r_jack_render(timeline_file, output_file) ) ? EXIT_FAILURE : EXIT_SUCCESS);
+
 	if( r_monome_init() )
 		exit(EXIT_FAILURE);
 
+	if( log_file && timeline_log_open(log_file, jack_get_buffer_size(state.client), state.sample_rate) )
+		exit(EXIT_FAILURE);
+
+	if( state.config.stats_socket && stats_serve(state.config.stats_socket) )
+		exit(EXIT_FAILURE);
+
+	if( record_file && recorder_start(record_file, state.sample_rate) )
+		exit(EXIT_FAILURE);
+
+	if( quality_init() )
+		exit(EXIT_FAILURE);
+
 	if( r_jack_activate() )
 		exit(EXIT_FAILURE);
 
@@ -259,6 +486,9 @@ int main(int argc, char **argv) {
 	atexit(cleanup);
 
 	r_monome_run_thread(state.monome);
+
+	/* the display loop runs on the main thread */
+	threads_apply(pthread_self(), &state.config.display_thread, "display");
 	monome_display_loop();
 
 	return 0;
@@ -0,0 +1,210 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * only built with --rt-check.  see private/rtcheck.h.
+ */
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "rtcheck.h"
+
+#define MAX_VIOLATIONS 64
+#define MAX_FRAMES     24
+
+typedef struct violation violation_t;
+
+struct violation {
+	const char *call;
+	unsigned int count;
+
+	void *frames[MAX_FRAMES];
+	int depth;
+};
+
+/* glibc's own entry points, which don't go back through us */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+static int (*real_mutex_lock)(pthread_mutex_t *);
+static ssize_t (*real_sendto)(int, const void *, size_t, int, const struct sockaddr *, socklen_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+
+static violation_t violations[MAX_VIOLATIONS];
+static int violation_count = 0;
+static unsigned int dropped = 0;
+
+static __thread int in_rt = 0;
+
+static void __attribute__((constructor)) rtcheck_init() {
+	void *frames[1];
+
+	real_mutex_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+	real_sendto     = dlsym(RTLD_NEXT, "sendto");
+	real_write      = dlsym(RTLD_NEXT, "write");
+
+	/* the first backtrace() loads libgcc, which allocates.  get that
+	   out of the way now. */
+	backtrace(frames, 1);
+}
+
+void rtcheck_enter() {
+	in_rt = 1;
+}
+
+void rtcheck_leave() {
+	in_rt = 0;
+}
+
+static void violation(const char *call) {
+	void *frames[MAX_FRAMES];
+	violation_t *v;
+	int i, depth;
+
+	/* nothing we do in here should count */
+	in_rt = 0;
+
+	depth = backtrace(frames, MAX_FRAMES);
+
+	/* the same call from the same place only gets listed once.  the
+	   JACK thread is the only one that gets here, so no locking. */
+	for( i = 0; i < violation_count; i++ ) {
+		v = &violations[i];
+
+		if( v->call == call && v->depth == depth
+		    && !memcmp(v->frames, frames, sizeof(void *) * depth) ) {
+			v->count++;
+			goto out;
+		}
+	}
+
+	if( violation_count == MAX_VIOLATIONS ) {
+		dropped++;
+		goto out;
+	}
+
+	v = &violations[violation_count++];
+	v->call  = call;
+	v->count = 1;
+	v->depth = depth;
+	memcpy(v->frames, frames, sizeof(void *) * depth);
+
+out:
+	in_rt = 1;
+}
+
+int rtcheck_report() {
+	violation_t *v;
+	int i;
+
+	if( !violation_count )
+		return 0;
+
+	fprintf(stderr, "\nrt-check: the JACK thread did things it shouldn't have:\n");
+
+	for( i = 0; i < violation_count; i++ ) {
+		v = &violations[i];
+
+		fprintf(stderr, "\n    %s() called %u time%s from:\n", v->call, v->count, ( v->count > 1 ) ? "s" : "");
+		fflush(stderr);
+
+		/* skip ourselves and the interposed call */
+		backtrace_symbols_fd(v->frames + 2, v->depth - 2, STDERR_FILENO);
+	}
+
+	if( dropped )
+		fprintf(stderr, "\n    ...and %u more that didn't fit\n", dropped);
+
+	fprintf(stderr, "\n");
+	return violation_count;
+}
+
+void *malloc(size_t size) {
+	if( in_rt )
+		violation("malloc");
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	if( in_rt )
+		violation("calloc");
+
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	if( in_rt )
+		violation("realloc");
+
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+	if( in_rt && ptr )
+		violation("free");
+
+	__libc_free(ptr);
+}
+
+/* in case something calls these before our constructor has run */
+#define RESOLVE(f, name) do { \
+	if( !f ) \
+		f = dlsym(RTLD_NEXT, name); \
+} while( 0 )
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+	if( in_rt )
+		violation("pthread_mutex_lock");
+
+	RESOLVE(real_mutex_lock, "pthread_mutex_lock");
+
+	return real_mutex_lock(mutex);
+}
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+               const struct sockaddr *addr, socklen_t addrlen) {
+	if( in_rt )
+		violation("sendto");
+
+	RESOLVE(real_sendto, "sendto");
+
+	return real_sendto(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+	if( in_rt )
+		violation("write");
+
+	RESOLVE(real_write, "write");
+
+	return real_write(fd, buf, count);
+}
+
+#undef RESOLVE
@@ -0,0 +1,173 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "types.h"
+#include "sample.h"
+
+/* the usual size of an explicit huge page on x86 and arm64 */
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+#define MB(x) ((x) / (1024.0 * 1024.0))
+
+extern state_t state;
+
+static size_t total = 0;
+static size_t locked = 0;
+
+static int warned_lock = 0;
+static int warned_huge = 0;
+
+static size_t round_up(size_t size, size_t to) {
+	return (size + to - 1) & ~(to - 1);
+}
+
+void sample_lock(void *data, size_t size) {
+	total += size;
+
+	if( locked + size > (size_t) state.config.lock_budget * 1024 * 1024 )
+		return;
+
+	if( mlock(data, size) ) {
+		if( !warned_lock++ )
+			printf("memory: couldn't lock sample data (is your memlock limit too low?)\n");
+
+		return;
+	}
+
+	locked += size;
+}
+
+static void *map_explicit(size_t size) {
+	void *data;
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+
+	if( data == MAP_FAILED ) {
+		if( !warned_huge++ )
+			printf("memory: no huge pages available, using normal ones\n");
+
+		return NULL;
+	}
+
+	return data;
+}
+
+static void *map_transparent(size_t size) {
+	size_t page, i;
+	char *data;
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if( data == MAP_FAILED )
+		return NULL;
+
+	/* the hint has to go in before the pages are touched, so we can't
+	   use MAP_POPULATE and have to fault them in ourselves. */
+	madvise(data, size, MADV_HUGEPAGE);
+
+	page = sysconf(_SC_PAGESIZE);
+	for( i = 0; i < size; i += page )
+		data[i] = 0;
+
+	return data;
+}
+
+static void *map_normal(size_t size) {
+	void *data;
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+	return ( data == MAP_FAILED ) ? NULL : data;
+}
+
+static size_t mapped_size(size_t size) {
+	if( state.config.hugepages == SAMPLE_HUGEPAGES_EXPLICIT )
+		return round_up(size, HUGEPAGE_SIZE);
+
+	return round_up(size, sysconf(_SC_PAGESIZE));
+}
+
+void *sample_alloc(size_t size) {
+	void *data = NULL;
+
+	if( !size )
+		return NULL;
+
+	size = mapped_size(size);
+
+	switch( state.config.hugepages ) {
+	case SAMPLE_HUGEPAGES_EXPLICIT:
+		data = map_explicit(size);
+		break;
+
+	case SAMPLE_HUGEPAGES_TRANSPARENT:
+		data = map_transparent(size);
+		break;
+
+	case SAMPLE_HUGEPAGES_OFF:
+		break;
+	}
+
+	/* anonymous mappings come back zeroed, just like calloc() */
+	if( !data && !(data = map_normal(size)) )
+		return NULL;
+
+	sample_lock(data, size);
+	return data;
+}
+
+void sample_free(void *data, size_t size) {
+	if( !data )
+		return;
+
+	/* munmap() drops the lock along with the mapping.  loops are only
+	   ever freed when they fail to load, so we don't bother taking
+	   them back out of the totals. */
+	munmap(data, mapped_size(size));
+}
+
+size_t sample_total() {
+	return total;
+}
+
+size_t sample_locked() {
+	return locked;
+}
+
+void sample_report() {
+	if( !total )
+		return;
+
+	printf("\nmemory: %.1f MB of samples, %.1f MB locked", MB(total), MB(locked));
+
+	/* mlockall takes care of the rest */
+	if( locked < total && !state.config.mlockall )
+		printf(", %.1f MB not (raise \"lock\" under [memory] to lock it all)", MB(total - locked));
+
+	printf("\n");
+}
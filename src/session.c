@@ -23,12 +23,21 @@
 #include <libgen.h>
 
 #include "config_parser.h"
+#include "bundle.h"
+#include "capture.h"
+#include "group.h"
+#include "engine.h"
 #include "session.h"
+#include "trace.h"
 #include "rove.h"
 #include "util.h"
 
 #define SESSION_T(x) ((session_t *) x)
 
+/* with "quantize = 0" cuts aren't quantized, but patterns still need a
+   grid to step on.  they get sixteenth notes. */
+#define UNQUANTIZED_GRID 0.25
+
 
 extern state_t state;
 
@@ -37,29 +46,16 @@ typedef struct {
 	const char *path;
 } _cb_data_t;
 
-static group_t *initialize_groups(uint_t group_count) {
-	group_t *groups;
-	int i;
-
-	if( !(groups = calloc(sizeof(group_t), group_count)) )
-		return NULL;
-
-	for( i = 0; i < group_count; i++ )
-		groups[i].idx = i;
-
-	return groups;
-}
-
 static void file_section_callback(const conf_section_t *section, void *arg) {
 	session_t *session = *((session_t **) arg);
 	static int y = 1;
 
 	unsigned int e, c, r, group, reverse, *v, this_y;
+	double speed, capture;
 	file_t *f;
-	double speed;
-	char *path, *buf;
+	char *buf;
 
-	conf_pair_t *pair = NULL;
+	const conf_pair_t *pair = NULL, *path = NULL;
 
 	if( !session ) {
 		fprintf(stderr, "file block specified before session block, aieee!\n");
@@ -67,17 +63,17 @@ static void file_section_callback(const conf_section_t *section, void *arg) {
 	}
 
 	this_y  = 0;
-	path    = NULL;
 	group   = 0;
 	r       = 1;
 	c       = 0;
 	reverse = 0;
 	speed   = 1.0;
+	capture = 0;
 
 	while( (e = conf_getvar(section, &pair)) ) {
 		switch( e ) {
 		case 'p': /* file path */
-			path = pair->value;
+			path = pair;
 			continue;
 
 		case 'v': /* reverse */
@@ -85,7 +81,11 @@ static void file_section_callback(const conf_section_t *section, void *arg) {
 			continue;
 
 		case 's': /* speed */
-			speed = strtod(pair->value, NULL);
+			speed = conf_pair_double(pair);
+			continue;
+
+		case 'a': /* capture */
+			capture = conf_pair_double(pair);
 			continue;
 
 		case 'g': /* group */
@@ -102,31 +102,43 @@ static void file_section_callback(const conf_section_t *section, void *arg) {
 
 		case 'y':
 			v = &this_y;
+			break;
+
+		default:
+			continue;
 		}
 
-		*v = (unsigned int) strtol(pair->value, NULL, 10);
+		*v = (unsigned int) conf_pair_long(pair);
 	}
 
-	if( !path ) {
+	if( !path && capture <= 0 ) {
 		printf("no file path specified in file section starting at line %d\n", section->start_line);
-		goto err;
+		return;
 	}
 
 	if( !group ) {
 		printf("no group specified in file section starting at line %d\n", section->start_line);
-		goto err;
+		return;
 	}
 
-	if( asprintf(&buf, "%s/%s", session->dirname, path) < 0 ) {
-		fprintf(stderr, "couldn't allocate string buffer for loop %s, aieee!",
-	            path);
-		goto err;
-	}
+	if( !path ) {
+		/* a slot to record into from capture_in, see capture.h */
+		if( !(f = capture_new(capture, 2, session)) ) {
+			fprintf(stderr, "couldn't allocate capture slot, aieee!\n");
+			return;
+		}
 
-	free(path);
+		buf = NULL;
+	} else {
+		if( asprintf(&buf, "%s/%.*s", session->dirname, path->vlen, path->value) < 0 ) {
+			fprintf(stderr, "couldn't allocate string buffer for loop %.*s, aieee!",
+			        path->vlen, path->value);
+			return;
+		}
 
-	if( !(f = file_new_from_path(buf)) )
-		goto err_load;
+		if( !(f = file_new_from_path(buf)) )
+			goto err_load;
+	}
 
 	if( group > state.group_count )
 		group = state.group_count;
@@ -135,11 +147,11 @@ static void file_section_callback(const conf_section_t *section, void *arg) {
 		y = 1;
 
 	f->path = buf;
-	f->speed = speed;
+	f->voice->speed = speed;
 	f->row_span = r;
 	f->columns  = (c) ? ((c - 1) & 0xF) + 1 : session->cols;
 	f->group = &state.groups[group - 1];
-	f->play_direction = ( reverse ) ? FILE_PLAY_DIRECTION_REVERSE : FILE_PLAY_DIRECTION_FORWARD;
+	f->voice->play_direction = ( reverse ) ? FILE_PLAY_DIRECTION_REVERSE : FILE_PLAY_DIRECTION_FORWARD;
 
 	list_push(&session->files, TAIL, f);
 
@@ -154,15 +166,64 @@ static void file_section_callback(const conf_section_t *section, void *arg) {
 err_load:
 	free(buf);
 	return;
-err:
-	free(path);
-	return;
+}
+
+static void group_section_callback(const conf_section_t *section, void *arg) {
+	session_t *session = *((session_t **) arg);
+	const conf_pair_t *pair = NULL;
+	int e, group, channels;
+	double quantize;
+
+	if( !session ) {
+		fprintf(stderr, "group block specified before session block, aieee!\n");
+		assert(session);
+	}
+
+	group    = 0;
+	channels = 0;
+	quantize = SESSION_QUANTIZE_INHERIT;
+
+	while( (e = conf_getvar(section, &pair)) ) {
+		switch( e ) {
+		case 'g': /* group */
+			group = (int) conf_pair_long(pair);
+			break;
+
+		case 'q': /* quantize */
+			quantize = conf_pair_double(pair);
+			break;
+
+		case 'n': /* channels */
+			channels = (int) conf_pair_long(pair);
+			break;
+		}
+	}
+
+	if( group < 1 || group > state.group_count ) {
+		printf("no valid group specified in group section starting at line %d\n", section->start_line);
+		return;
+	}
+
+	/* groups are shared by every session, so this is for all of them */
+	if( channels < 0 || channels > GROUP_MAX_CHANNELS )
+		printf("group %d can't have %d channels (1 to %d will do), ignoring it\n",
+		       group, channels, GROUP_MAX_CHANNELS);
+	else if( channels )
+		state.groups[group - 1].channels = channels;
+
+	if( quantize < 0 )
+		return;
+
+	if( !session->group_quantize && session_group_quantize_new(session) )
+		return;
+
+	session->group_quantize[group - 1] = quantize;
 }
 
 static void session_section_callback(const conf_section_t *section, void *arg) {
 	_cb_data_t *data = arg;
 	session_t *session, **sptr = arg;
-	conf_pair_t *pair = NULL;
+	const conf_pair_t *pair = NULL;
 	char v;
 
 	if( !(session = session_new(data->path)) ) {
@@ -180,40 +241,44 @@ static void session_section_callback(const conf_section_t *section, void *arg) {
 		INHERIT_VAR(cols);
 
 #undef INHERIT_VAR
+
+		if( (*sptr)->group_quantize && !session_group_quantize_new(session) )
+			memcpy(session->group_quantize, (*sptr)->group_quantize,
+			       sizeof(double) * state.group_count);
 	} else
 		session->cols = 0;
 
 	while( (v = conf_getvar(section, &pair)) ) {
 		switch( v ) {
 		case 'q': /* quantize */
-			session->beat_multiplier = strtod(pair->value, NULL);
+			session->beat_multiplier = conf_pair_double(pair);
 			break;
 
 		case 'b': /* bpm */
-			session->bpm = strtod(pair->value, NULL);
+			session->bpm = conf_pair_double(pair);
 			break;
 
 		case 'g': /* groups */
 			if( !state.group_count )
-				state.group_count = (int) strtol(pair->value, NULL, 10);
+				state.group_count = (int) conf_pair_long(pair);
 
 			break;
 
 		case '1': /* pattern1 */
-			session->pattern_lengths[0] = (int) strtol(pair->value, NULL, 10);
+			session->pattern_lengths[0] = (int) conf_pair_long(pair);
 			break;
 
 		case '2': /* pattern2 */
-			session->pattern_lengths[1] = (int) strtol(pair->value, NULL, 10);
+			session->pattern_lengths[1] = (int) conf_pair_long(pair);
 			break;
 
 		case 'c': /* columns */
-			session->cols = (uint_t) strtoul(pair->value, NULL, 10);
+			session->cols = (uint_t) conf_pair_long(pair);
 		}
 	}
 
 	if( !state.groups )
-		state.groups = initialize_groups(state.group_count);
+		state.groups = group_array_new(state.group_count);
 
 	*sptr = session;
 }
@@ -238,21 +303,68 @@ int session_prev() {
 	return 0;
 }
 
-static void recalculate_bpm_variables() {
-	state.frames_per_beat = lrintf((60 / state.bpm) * (double) jack_get_sample_rate(state.client));
-	state.snap_delay = MAX(state.frames_per_beat * state.beat_multiplier, 1);
+static jack_nframes_t snap_delay(double beat_multiplier) {
+	if( !beat_multiplier )
+		beat_multiplier = UNQUANTIZED_GRID;
+
+	return MAX(state.frames_per_beat * beat_multiplier, 1);
 }
 
-void session_activate(session_t *self) {
-	state.beat_multiplier = self->beat_multiplier;
-	state.bpm = self->bpm;
+static void recalculate_bpm_variables(session_t *self) {
+	double quantize;
+	group_t *g;
+	int i;
 
-	state.files = &self->files;
+	state.frames_per_beat = lrintf((60 / state.bpm) * (double) state.sample_rate);
+	state.snap_delay = snap_delay(self->beat_multiplier);
+
+	for( i = 0; i < state.group_count; i++ ) {
+		g = &state.groups[i];
+
+		quantize = self->beat_multiplier;
+		if( self->group_quantize && self->group_quantize[i] >= 0 )
+			quantize = self->group_quantize[i];
+
+		g->snap_delay  = snap_delay(quantize);
+		g->unquantized = !quantize;
+	}
+}
+
+/* the engine's half of a session switch, the grid everything runs on */
+static void session_timing(void *arg, void *data, double value) {
+	session_t *self = arg;
 
+	trace_instant(TRACE_SESSION, 0);
+
+	state.beat_multiplier = ( self->beat_multiplier ) ? self->beat_multiplier : UNQUANTIZED_GRID;
+	state.bpm = self->bpm;
 	state.pattern_lengths = self->pattern_lengths;
+
+	recalculate_bpm_variables(self);
+}
+
+void session_activate(session_t *self) {
+	/* the rows change for the next press, the timing with the cycle
+	   this one's logged with */
+	state.files = &self->files;
 	state.active_session = self;
 
-	recalculate_bpm_variables();
+	if( engine_command(session_timing, self, NULL, 0) )
+		fprintf(stderr, "session: couldn't switch the engine over, aieee!\n");
+}
+
+int session_group_quantize_new(session_t *self) {
+	int i;
+
+	if( !(self->group_quantize = calloc(sizeof(double), state.group_count)) ) {
+		fprintf(stderr, "couldn't allocate group quantize table, aieee!\n");
+		return 1;
+	}
+
+	for( i = 0; i < state.group_count; i++ )
+		self->group_quantize[i] = SESSION_QUANTIZE_INHERIT;
+
+	return 0;
 }
 
 session_t *session_new(const char *path) {
@@ -272,6 +384,7 @@ session_t *session_new(const char *path) {
 
 void session_free(session_t *self) {
 	list_remove_raw(LIST_MEMBER_T(self));
+	free(self->group_quantize);
 	free(self->path);
 	free(self);
 }
@@ -281,11 +394,13 @@ int session_load(const char *path) {
 
 	conf_var_t file_vars[] = {
 		{"path",    NULL, STRING, 'p'},
+		{"group",   NULL,    INT, 'g'},
 		{"groups",  NULL,    INT, 'g'},
 		{"columns", NULL,    INT, 'c'},
 		{"rows",    NULL,    INT, 'r'},
 		{"reverse", NULL,   BOOL, 'v'},
 		{"speed",   NULL, DOUBLE, 's'},
+		{"capture", NULL, DOUBLE, 'a'},
 		{"y",       NULL,    INT, 'y'},
 		{NULL}
 	};
@@ -300,12 +415,23 @@ int session_load(const char *path) {
 		{NULL}
 	};
 
+	conf_var_t group_vars[] = {
+		{"group",    NULL,    INT, 'g'},
+		{"quantize", NULL, DOUBLE, 'q'},
+		{"channels", NULL,    INT, 'n'},
+		{NULL}
+	};
+
 	conf_section_t config_sections[] = {
 		{"session", session_vars, session_section_callback, &data},
+		{"group",   group_vars  , group_section_callback, &data},
 		{"file",    file_vars   , file_section_callback, &data},
 		{NULL}
 	};
 
+	if( bundle_is_bundle(path) )
+		return bundle_load(path);
+
 	if( conf_load(path, config_sections, 0) )
 		return 1;
 
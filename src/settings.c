@@ -17,17 +17,58 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "config_parser.h"
+#include "quality.h"
 #include "rove.h"
+#include "sample.h"
+#include "threads.h"
 
 extern state_t state;
 
+/* a priority nobody set, which is just below JACK (see threads.c) */
+#define PRIORITY_UNSET   LONG_MIN
+#define PRIORITY_DEFAULT -1
+
+static int thread_settings(thread_config_t *config, const char *section,
+                           char *policy, long priority, char *cpus) {
+	config->policy = -1;
+	config->priority = ( priority == PRIORITY_UNSET ) ? PRIORITY_DEFAULT : priority;
+
+	if( priority != PRIORITY_UNSET && !policy )
+		printf("conf: a priority under [%s] does nothing without a policy, ignoring it.\n", section);
+
+	if( policy ) {
+		if( (config->policy = threads_parse_policy(policy)) < 0 )
+			usage_printf_return("conf: \"%s\" under [%s] is not a valid scheduling policy.\n"
+								"             please check your conf file!\n", policy, section);
+
+		free(policy);
+		config->set = 1;
+	}
+
+	if( cpus ) {
+		if( threads_parse_cpus(cpus, &config->cpus) )
+			usage_printf_return("conf: \"%s\" under [%s] is not a valid list of cpus.\n"
+								"             please check your conf file!\n", cpus, section);
+
+		free(cpus);
+		config->set = 1;
+	}
+
+	return 0;
+}
+
 int settings_load(const char *path) {
-	char *op, *ohp, *olp, *buf;
-	int c, r;
+	char *op, *ohp, *olp, *ss, *hp, *buf;
+	char *in_pol, *in_cpus, *disp_pol, *disp_cpus;
+	long lock, in_prio, disp_prio;
+	int c, r, mla, m_chan, m_note, m_cols, m_cc, rec_groups, q_high, q_low, i;
+	char *q_floor;
+	long rec_buffer;
 
 	conf_var_t monome_vars[] = {
 		{"columns", &c, INT, 'c'},
@@ -42,9 +83,63 @@ int settings_load(const char *path) {
 		{NULL}
 	};
 
+	conf_var_t stats_vars[] = {
+		{"socket", &ss, STRING, 's'},
+		{NULL}
+	};
+
+	conf_var_t memory_vars[] = {
+		{"lock",      &lock, LONG,   'l'},
+		{"hugepages", &hp,   STRING, 'h'},
+		{"mlockall",  &mla,  BOOL,   'm'},
+		{NULL}
+	};
+
+	conf_var_t input_vars[] = {
+		{"policy",   &in_pol,  STRING, 'p'},
+		{"priority", &in_prio, LONG,   'r'},
+		{"cpus",     &in_cpus, STRING, 'c'},
+		{NULL}
+	};
+
+	conf_var_t display_vars[] = {
+		{"policy",   &disp_pol,  STRING, 'p'},
+		{"priority", &disp_prio, LONG,   'r'},
+		{"cpus",     &disp_cpus, STRING, 'c'},
+		{NULL}
+	};
+
+	conf_var_t midi_vars[] = {
+		{"channel", &m_chan, INT, 'h'},
+		{"note",    &m_note, INT, 'n'},
+		{"columns", &m_cols, INT, 'c'},
+		{"cc",      &m_cc,   INT, 'v'},
+		{NULL}
+	};
+
+	conf_var_t record_vars[] = {
+		{"groups", &rec_groups, BOOL, 'g'},
+		{"buffer", &rec_buffer, LONG, 'b'},
+		{NULL}
+	};
+
+	conf_var_t quality_vars[] = {
+		{"floor", &q_floor, STRING, 'f'},
+		{"high",  &q_high,  INT,    'h'},
+		{"low",   &q_low,   INT,    'l'},
+		{NULL}
+	};
+
 	conf_section_t config_sections[] = {
 		{"monome", monome_vars},
 		{"osc",    osc_vars},
+		{"stats",  stats_vars},
+		{"memory", memory_vars},
+		{"input",  input_vars},
+		{"display", display_vars},
+		{"midi",   midi_vars},
+		{"record", record_vars},
+		{"quality", quality_vars},
 		{NULL}
 	};
 
@@ -55,6 +150,24 @@ int settings_load(const char *path) {
 	op  = NULL;
 	ohp = NULL;
 	olp = NULL;
+	ss  = NULL;
+	hp  = NULL;
+	mla = 0;
+	lock = 0;
+
+	in_pol   = in_cpus   = NULL;
+	disp_pol = disp_cpus = NULL;
+	in_prio  = disp_prio = PRIORITY_UNSET;
+
+	m_chan = m_cols = m_cc = 0;
+	m_note = state.config.midi.note;
+
+	rec_groups = 0;
+	rec_buffer = 0;
+
+	q_floor = NULL;
+	q_high  = state.config.quality.high;
+	q_low   = state.config.quality.low;
 
 	if( conf_load(path, config_sections, 0) )
 		return 0;
@@ -91,6 +204,72 @@ int settings_load(const char *path) {
 		state.config.osc_listen_port = olp;
 	}
 
+	if( ss && !state.config.stats_socket )
+		state.config.stats_socket = ss;
+
+	if( lock < 0 )
+		usage_printf_return("conf: \"%ld\" is not a valid amount of memory to lock.\n"
+							"             please check your conf file!\n", lock);
+
+	state.config.lock_budget = lock;
+	state.config.mlockall = mla;
+
+	if( hp ) {
+		if( !strcmp(hp, "transparent") )
+			state.config.hugepages = SAMPLE_HUGEPAGES_TRANSPARENT;
+		else if( !strcmp(hp, "explicit") )
+			state.config.hugepages = SAMPLE_HUGEPAGES_EXPLICIT;
+		else if( strcmp(hp, "off") )
+			usage_printf_return("conf: \"%s\" is not a valid hugepages setting (off, transparent or explicit).\n"
+								"             please check your conf file!\n", hp);
+
+		free(hp);
+	}
+
+	if( m_chan < 0 || m_chan > 16 )
+		usage_printf_return("conf: \"%d\" is not a valid midi channel (1-16, or 0 for all).\n"
+							"             please check your conf file!\n", m_chan);
+
+	if( m_note < 0 || m_note > 127 || m_cc < 0 || m_cc > 127 || m_cols < 0 )
+		usage_printf_return("conf: the [midi] section has a note, cc or column count out of range.\n"
+							"             please check your conf file!\n");
+
+	state.config.midi.channel = m_chan;
+	state.config.midi.note    = m_note;
+	state.config.midi.columns = m_cols;
+	state.config.midi.cc      = m_cc;
+
+	if( rec_buffer < 0 )
+		usage_printf_return("conf: \"%ld\" is not a valid number of seconds to buffer.\n"
+							"             please check your conf file!\n", rec_buffer);
+
+	state.config.record.groups = rec_groups;
+	state.config.record.buffer = rec_buffer;
+
+	if( q_floor ) {
+		for( i = QUALITY_SINC; i <= QUALITY_LINEAR; i++ )
+			if( !strcmp(q_floor, quality_name(i)) )
+				break;
+
+		if( i > QUALITY_LINEAR )
+			usage_printf_return("conf: \"%s\" is not a valid quality floor (sinc, cubic or linear).\n"
+								"             please check your conf file!\n", q_floor);
+
+		state.config.quality.floor = i;
+		free(q_floor);
+	}
+
+	if( q_low < 0 || q_low >= q_high || q_high > 100 )
+		usage_printf_return("conf: the [quality] section wants 0 <= low < high <= 100.\n"
+							"             please check your conf file!\n");
+
+	state.config.quality.high = q_high;
+	state.config.quality.low  = q_low;
+
+	if( thread_settings(&state.config.input_thread, "input", in_pol, in_prio, in_cpus)
+	    || thread_settings(&state.config.display_thread, "display", disp_pol, disp_prio, disp_cpus) )
+		return 1;
+
 	return 0;
 }
 
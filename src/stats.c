@@ -0,0 +1,279 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * metrics are served as prometheus text on a unix domain socket.  the
+ * exporter can either read straight off the socket or speak HTTP to it
+ * (we answer with a minimal HTTP/1.0 response if the request starts
+ * with "GET").
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <jack/jack.h>
+
+#include "histogram.h"
+#include "latency.h"
+#include "recorder.h"
+#include "sample.h"
+#include "stats.h"
+
+/* how long a client gets to send its request before we just answer */
+#define REQUEST_TIMEOUT_MS 100
+
+extern state_t state;
+
+static struct {
+	/* since the last scrape */
+	histogram_t window;
+	uint64_t min_ns;
+
+	/* since startup */
+	uint64_t cycles;
+	uint64_t total_ns;
+	uint64_t xruns;
+	uint64_t display_frames;
+	uint64_t osc_in;
+	uint64_t osc_out;
+
+	/* last cycle */
+	int voices;
+	int src_voices;
+	jack_nframes_t nframes;
+	jack_nframes_t rate;
+} stats = {
+	.min_ns = UINT64_MAX
+};
+
+static char *socket_path = NULL;
+static pthread_t thread;
+
+void stats_cycle(const engine_cycle_t *cycle, uint64_t ns) {
+	uint64_t cur;
+
+	histogram_add(&stats.window, ns);
+	__atomic_fetch_add(&stats.cycles, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats.total_ns, ns, __ATOMIC_RELAXED);
+
+	/* the scraper resets this, so the loop only goes around again if
+	   it got in between our load and store. */
+	cur = __atomic_load_n(&stats.min_ns, __ATOMIC_RELAXED);
+	while( ns < cur && !__atomic_compare_exchange_n(&stats.min_ns, &cur, ns, 1,
+	                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+
+	__atomic_store_n(&stats.voices, cycle->voices, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats.src_voices, cycle->src_voices, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats.nframes, cycle->nframes, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats.rate, cycle->rate, __ATOMIC_RELAXED);
+}
+
+void stats_xrun() {
+	__atomic_fetch_add(&stats.xruns, 1, __ATOMIC_RELAXED);
+}
+
+void stats_display_frame() {
+	__atomic_fetch_add(&stats.display_frames, 1, __ATOMIC_RELAXED);
+}
+
+void stats_osc_in() {
+	__atomic_fetch_add(&stats.osc_in, 1, __ATOMIC_RELAXED);
+}
+
+void stats_osc_out() {
+	__atomic_fetch_add(&stats.osc_out, 1, __ATOMIC_RELAXED);
+}
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define TAKE(x, v) __atomic_exchange_n(&(x), v, __ATOMIC_RELAXED)
+
+static void write_metric(FILE *f, const char *name, const char *type, const char *help) {
+	fprintf(f, "# HELP rove_%s %s\n# TYPE rove_%s %s\n", name, help, name, type);
+}
+
+static void write_stats(FILE *f) {
+	jack_nframes_t nframes, rate;
+	histogram_t window;
+	uint64_t min;
+
+	/* grab the window first so it's as consistent as we can make it
+	   without locking the JACK thread out */
+	histogram_take(&stats.window, &window);
+	min = TAKE(stats.min_ns, UINT64_MAX);
+
+	if( !window.count )
+		min = 0;
+
+	nframes = LOAD(stats.nframes);
+	rate    = LOAD(stats.rate);
+
+	write_metric(f, "process_seconds", "summary",
+	             "time spent in the JACK process callback (quantile since the last scrape)");
+	fprintf(f, "rove_process_seconds{quantile=\"0.99\"} %.9f\n", histogram_quantile(&window, 0.99) / 1e9);
+	fprintf(f, "rove_process_seconds_sum %.9f\n", LOAD(stats.total_ns) / 1e9);
+	fprintf(f, "rove_process_seconds_count %" PRIu64 "\n", LOAD(stats.cycles));
+
+	write_metric(f, "process_min_seconds", "gauge", "shortest process callback since the last scrape");
+	fprintf(f, "rove_process_min_seconds %.9f\n", min / 1e9);
+
+	write_metric(f, "process_avg_seconds", "gauge", "mean process callback since the last scrape");
+	fprintf(f, "rove_process_avg_seconds %.9f\n", ( window.count ) ? window.sum / (window.count * 1e9) : 0.0);
+
+	write_metric(f, "process_max_seconds", "gauge", "longest process callback since the last scrape");
+	fprintf(f, "rove_process_max_seconds %.9f\n", window.max / 1e9);
+
+	write_metric(f, "period_seconds", "gauge", "length of a JACK period, i.e. the callback's deadline");
+	fprintf(f, "rove_period_seconds %.9f\n", ( rate ) ? nframes / (double) rate : 0.0);
+
+	write_metric(f, "xruns_total", "counter", "xruns reported by JACK");
+	fprintf(f, "rove_xruns_total %" PRIu64 "\n", LOAD(stats.xruns));
+
+	if( state.client ) {
+		write_metric(f, "dsp_load_percent", "gauge", "JACK's estimate of its DSP load");
+		fprintf(f, "rove_dsp_load_percent %.2f\n", jack_cpu_load(state.client));
+	}
+
+	write_metric(f, "voices", "gauge", "groups with an active loop");
+	fprintf(f, "rove_voices %d\n", LOAD(stats.voices));
+
+	write_metric(f, "src_voices", "gauge", "active varispeed loops");
+	fprintf(f, "rove_src_voices %d\n", LOAD(stats.src_voices));
+
+	write_metric(f, "quality", "gauge", "rung of the quality ladder varispeed loops are on (0 sinc, 1 cubic, 2 linear)");
+	fprintf(f, "rove_quality %d\n", LOAD(state.quality));
+
+	latency_write(f);
+
+	write_metric(f, "record_dropped_frames_total", "counter", "frames --record lost to a full ring buffer");
+	fprintf(f, "rove_record_dropped_frames_total %" PRIu64 "\n", recorder_dropped());
+
+	write_metric(f, "sample_bytes", "gauge", "memory holding loop data");
+	fprintf(f, "rove_sample_bytes %zu\n", sample_total());
+
+	write_metric(f, "sample_locked_bytes", "gauge", "...of which is mlock()ed");
+	fprintf(f, "rove_sample_locked_bytes %zu\n", sample_locked());
+
+	write_metric(f, "display_frames_total", "counter", "passes of the monome display loop");
+	fprintf(f, "rove_display_frames_total %" PRIu64 "\n", LOAD(stats.display_frames));
+
+	write_metric(f, "osc_packets_received_total", "counter", "button events from the monome");
+	fprintf(f, "rove_osc_packets_received_total %" PRIu64 "\n", LOAD(stats.osc_in));
+
+	write_metric(f, "osc_packets_sent_total", "counter", "LED messages sent to the monome");
+	fprintf(f, "rove_osc_packets_sent_total %" PRIu64 "\n", LOAD(stats.osc_out));
+}
+
+#undef LOAD
+#undef TAKE
+
+static void serve_client(int fd) {
+	struct pollfd pfd = {fd, POLLIN, 0};
+	char req[512];
+	ssize_t len;
+	FILE *f;
+
+	len = 0;
+	if( poll(&pfd, 1, REQUEST_TIMEOUT_MS) > 0 )
+		len = recv(fd, req, sizeof(req) - 1, 0);
+
+	if( !(f = fdopen(fd, "w")) ) {
+		close(fd);
+		return;
+	}
+
+	if( len >= 4 && !strncmp(req, "GET ", 4) )
+		fprintf(f, "HTTP/1.0 200 OK\r\n"
+		           "Content-Type: text/plain; version=0.0.4\r\n"
+		           "Connection: close\r\n\r\n");
+
+	write_stats(f);
+	fclose(f);
+}
+
+static void *stats_thread(void *user_data) {
+	int sock, fd;
+
+	sock = (int) (intptr_t) user_data;
+
+	for(;;) {
+		if( (fd = accept(sock, NULL, NULL)) < 0 )
+			continue;
+
+		serve_client(fd);
+	}
+
+	return NULL;
+}
+
+int stats_serve(const char *path) {
+	struct sockaddr_un addr;
+	int sock;
+
+	if( strlen(path) >= sizeof(addr.sun_path) ) {
+		printf("stats: socket path %s is too long\n", path);
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if( (sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+		perror("stats: socket");
+		return 1;
+	}
+
+	/* a stale socket from a previous run would make bind() fail */
+	unlink(path);
+
+	if( bind(sock, (struct sockaddr *) &addr, sizeof(addr)) || listen(sock, 4) ) {
+		printf("stats: couldn't listen on %s\n", path);
+		close(sock);
+		return 1;
+	}
+
+	socket_path = strdup(path);
+
+	if( pthread_create(&thread, NULL, stats_thread, (void *) (intptr_t) sock) ) {
+		fprintf(stderr, "stats: couldn't start the stats thread, aieee!\n");
+		close(sock);
+		return 1;
+	}
+
+	return 0;
+}
+
+void stats_stop() {
+	if( !socket_path )
+		return;
+
+	pthread_cancel(thread);
+	unlink(socket_path);
+
+	free(socket_path);
+	socket_path = NULL;
+}
@@ -0,0 +1,164 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sched.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include <jack/jack.h>
+
+#include "threads.h"
+
+/* what we assume JACK runs at if we can't ask it */
+#define DEFAULT_JACK_PRIORITY 70
+
+extern state_t state;
+
+static const struct {
+	const char *name;
+	int policy;
+} policies[] = {
+	{"other", SCHED_OTHER},
+	{"fifo",  SCHED_FIFO},
+	{"rr",    SCHED_RR},
+	{"batch", SCHED_BATCH},
+	{"idle",  SCHED_IDLE},
+	{NULL}
+};
+
+int threads_parse_policy(const char *str) {
+	int i;
+
+	for( i = 0; policies[i].name; i++ )
+		if( !strcmp(str, policies[i].name) )
+			return policies[i].policy;
+
+	return -1;
+}
+
+int threads_parse_cpus(const char *str, unsigned long *mask) {
+	unsigned long first, last;
+	char *end;
+
+	*mask = 0;
+
+	if( !strcmp(str, "all") )
+		return 0;
+
+	while( *str ) {
+		first = last = strtoul(str, &end, 10);
+
+		if( end == str )
+			return 1;
+
+		if( *end == '-' ) {
+			str  = end + 1;
+			last = strtoul(str, &end, 10);
+
+			if( end == str || last < first )
+				return 1;
+		}
+
+		if( last >= sizeof(*mask) * 8 )
+			return 1;
+
+		for( ; first <= last; first++ )
+			*mask |= 1UL << first;
+
+		for( str = end; *str == ',' || *str == ' '; str++ );
+	}
+
+	return !*mask;
+}
+
+static int policy_is_rt(int policy) {
+	return ( policy == SCHED_FIFO || policy == SCHED_RR );
+}
+
+static int resolve_priority(const thread_config_t *config) {
+	int jack_prio, prio;
+
+	if( !policy_is_rt(config->policy) )
+		return 0;
+
+	prio = config->priority;
+
+	if( prio <= 0 ) {
+		jack_prio = ( state.client ) ? jack_client_real_time_priority(state.client) : -1;
+
+		if( jack_prio < 0 )
+			jack_prio = DEFAULT_JACK_PRIORITY;
+
+		prio += jack_prio;
+	}
+
+	if( prio < sched_get_priority_min(config->policy) )
+		prio = sched_get_priority_min(config->policy);
+
+	if( prio > sched_get_priority_max(config->policy) )
+		prio = sched_get_priority_max(config->policy);
+
+	return prio;
+}
+
+int threads_apply(pthread_t thread, const thread_config_t *config, const char *name) {
+	struct sched_param param;
+	cpu_set_t cpus;
+	int i, err;
+
+	if( !config->set )
+		return 0;
+
+	if( config->policy >= 0 ) {
+		param.sched_priority = resolve_priority(config);
+
+		if( (err = pthread_setschedparam(thread, config->policy, &param)) ) {
+			printf("threads: couldn't set scheduling for the %s thread: %s\n", name, strerror(err));
+			return 1;
+		}
+	}
+
+	if( config->cpus ) {
+		CPU_ZERO(&cpus);
+
+		for( i = 0; i < sizeof(config->cpus) * 8; i++ )
+			if( config->cpus & (1UL << i) )
+				CPU_SET(i, &cpus);
+
+		if( (err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus)) ) {
+			printf("threads: couldn't pin the %s thread: %s\n", name, strerror(err));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int threads_lock_memory() {
+	if( mlockall(MCL_CURRENT | MCL_FUTURE) ) {
+		printf("memory: couldn't lock rove's memory: %s\n"
+		       "        (is your memlock limit too low?)\n", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,315 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <jack/ringbuffer.h>
+#include <monome.h>
+
+#include "engine.h"
+#include "timeline.h"
+
+#define LINE_LEN 256
+
+/* seconds to let the last event ring out if the timeline has no end */
+#define DEFAULT_TAIL 4
+
+/* how often MIDI events are written out, and how many can wait */
+#define LOG_INTERVAL_MS 50
+#define LOG_MIDI_EVENTS 1024
+
+static int timeline_push(timeline_t *self, const timeline_event_t *event) {
+	timeline_event_t *e;
+	int i;
+
+	if( self->count == self->size ) {
+		self->size = ( self->size ) ? self->size * 2 : 256;
+
+		if( !(e = realloc(self->events, sizeof(timeline_event_t) * self->size)) )
+			return 1;
+
+		self->events = e;
+	}
+
+	/* a live log's MIDI events are written by another thread than the
+	   grid's, so they can come a little out of order.  they're never
+	   far off, so it's cheap to put each one where it goes. */
+	for( i = self->count; i > 0 && self->events[i - 1].frame > event->frame; i-- );
+
+	memmove(&self->events[i + 1], &self->events[i], sizeof(timeline_event_t) * (self->count - i));
+	self->events[i] = *event;
+	self->count++;
+
+	return 0;
+}
+
+timeline_t *timeline_load(const char *path) {
+	char line[LINE_LEN], word[16], *c;
+	unsigned long value;
+	timeline_event_t e;
+	uint64_t frame;
+	timeline_t *self;
+	int lines, n;
+	FILE *f;
+
+	if( !(f = fopen(path, "r")) ) {
+		printf("timeline: couldn't open %s\n", path);
+		return NULL;
+	}
+
+	if( !(self = calloc(1, sizeof(timeline_t))) ) {
+		fclose(f);
+		return NULL;
+	}
+
+	for( lines = 1; fgets(line, sizeof(line), f); lines++ ) {
+		if( (c = strchr(line, '#')) )
+			*c = '\0';
+
+		for( c = line; *c == ' ' || *c == '\t'; c++ );
+
+		if( !*c || *c == '\n' )
+			continue;
+
+		if( sscanf(c, "period %lu", &value) == 1 ) {
+			self->period = value;
+			continue;
+		}
+
+		if( sscanf(c, "rate %lu", &value) == 1 ) {
+			self->rate = value;
+			continue;
+		}
+
+		if( sscanf(c, "end %" SCNu64, &frame) == 1 ) {
+			self->end = frame;
+			continue;
+		}
+
+		n = sscanf(c, "%" SCNu64 " %u %u %15s %" SCNu64, &e.frame, &e.x, &e.y, word, &e.target);
+
+		if( n < 4 ) {
+			printf("timeline: can't make sense of line %d of %s\n", lines, path);
+			goto err;
+		}
+
+		if( n < 5 || e.target < e.frame )
+			e.target = e.frame;
+
+		e.value = 0;
+
+		if( !strcmp(word, "down") )
+			e.type = MONOME_BUTTON_DOWN;
+		else if( !strcmp(word, "up") )
+			e.type = MONOME_BUTTON_UP;
+		else if( !strcmp(word, "note") )
+			e.type = TIMELINE_MIDI_CUT;
+		else if( !strcmp(word, "volume") ) {
+			if( sscanf(c, "%*s %*s %*s %*s %lf", &e.value) != 1 ) {
+				printf("timeline: no volume on line %d of %s\n", lines, path);
+				goto err;
+			}
+
+			e.type = TIMELINE_MIDI_VOLUME;
+		} else {
+			printf("timeline: unknown event \"%s\" on line %d of %s\n", word, lines, path);
+			goto err;
+		}
+
+		if( timeline_push(self, &e) ) {
+			fprintf(stderr, "timeline: couldn't allocate events, aieee!\n");
+			goto err;
+		}
+	}
+
+	fclose(f);
+	return self;
+
+err:
+	fclose(f);
+	timeline_free(self);
+	return NULL;
+}
+
+void timeline_free(timeline_t *self) {
+	free(self->events);
+	free(self);
+}
+
+uint64_t timeline_end(const timeline_t *self, jack_nframes_t rate) {
+	if( self->end )
+		return self->end;
+
+	return (( self->count ) ? self->events[self->count - 1].frame : 0) + DEFAULT_TAIL * rate;
+}
+
+int timeline_is_midi(const timeline_event_t *self) {
+	return ( self->type == TIMELINE_MIDI_CUT || self->type == TIMELINE_MIDI_VOLUME );
+}
+
+void timeline_engine_event(const timeline_event_t *self, uint64_t start, engine_event_t *e) {
+	e->offset = self->frame - start;
+	e->type   = ( self->type == TIMELINE_MIDI_CUT ) ? ENGINE_EVENT_CUT : ENGINE_EVENT_VOLUME;
+	e->x      = self->x;
+	e->y      = self->y;
+	e->value  = self->value;
+}
+
+/**
+ * MIDI comes in on the audio thread, which can't write to a file, so
+ * it's put on a ring with the frame it landed on, and a thread of our
+ * own writes it out every so often.  the grid's events are written
+ * straight from the input thread, a line at a time.
+ */
+
+typedef struct {
+	uint64_t frame;
+	engine_event_t event;
+} logged_midi_t;
+
+static FILE *log_file = NULL;
+
+static jack_ringbuffer_t *log_ring = NULL;
+static pthread_t log_thread;
+static int log_stopping = 0;
+static uint64_t log_dropped = 0;  /* atomic, bumped by the audio thread */
+
+static void log_drain() {
+	logged_midi_t m;
+
+	while( jack_ringbuffer_read_space(log_ring) >= sizeof(m) ) {
+		jack_ringbuffer_read(log_ring, (char *) &m, sizeof(m));
+
+		if( m.event.type == ENGINE_EVENT_CUT )
+			fprintf(log_file, "%" PRIu64 " %u %u note\n", m.frame, m.event.x, m.event.y);
+		else
+			fprintf(log_file, "%" PRIu64 " 0 %u volume %.17g\n", m.frame, m.event.y, m.event.value);
+	}
+
+	fflush(log_file);
+}
+
+static void *log_loop(void *user_data) {
+	struct timespec req;
+	int stop;
+
+	req.tv_sec  = 0;
+	req.tv_nsec = LOG_INTERVAL_MS * 1000000;
+
+	do {
+		nanosleep(&req, NULL);
+
+		/* JACK is deactivated before we're told to stop, so one more
+		   pass gets everything */
+		stop = __atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE);
+
+		flockfile(log_file);
+		log_drain();
+		funlockfile(log_file);
+	} while( !stop );
+
+	return NULL;
+}
+
+int timeline_log_open(const char *path, jack_nframes_t period, jack_nframes_t rate) {
+	if( !(log_file = fopen(path, "w")) ) {
+		printf("timeline: couldn't open %s for writing\n", path);
+		return 1;
+	}
+
+	fprintf(log_file, "# rove event log\nperiod %u\nrate %u\n", period, rate);
+	fflush(log_file);
+
+	if( !(log_ring = jack_ringbuffer_create(sizeof(logged_midi_t) * LOG_MIDI_EVENTS)) ) {
+		fprintf(stderr, "timeline: couldn't allocate the MIDI log, aieee!\n");
+		return 0;
+	}
+
+	if( pthread_create(&log_thread, NULL, log_loop, NULL) ) {
+		fprintf(stderr, "timeline: couldn't start the MIDI log thread, aieee!\n");
+		jack_ringbuffer_free(log_ring);
+		log_ring = NULL;
+	}
+
+	return 0;
+}
+
+void timeline_log_event(uint64_t frame, uint64_t target, uint_t x, uint_t y, uint_t type) {
+	if( !log_file )
+		return;
+
+	/* the MIDI thread writes to the same file */
+	flockfile(log_file);
+
+	fprintf(log_file, "%" PRIu64 " %u %u %s", frame, x, y,
+	        ( type == MONOME_BUTTON_DOWN ) ? "down" : "up");
+
+	if( target != ENGINE_NO_TARGET )
+		fprintf(log_file, " %" PRIu64, target);
+
+	/* flushed every time so that a crash still leaves a usable log */
+	fputc('\n', log_file);
+	fflush(log_file);
+
+	funlockfile(log_file);
+}
+
+void timeline_log_midi(const engine_cycle_t *cycle) {
+	logged_midi_t m;
+	int i;
+
+	if( !log_ring )
+		return;
+
+	for( i = 0; i < cycle->nevents; i++ ) {
+		if( jack_ringbuffer_write_space(log_ring) < sizeof(m) ) {
+			__atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		m.frame = cycle->start_frame + cycle->events[i].offset;
+		m.event = cycle->events[i];
+
+		jack_ringbuffer_write(log_ring, (const char *) &m, sizeof(m));
+	}
+}
+
+void timeline_log_close(uint64_t end) {
+	if( !log_file )
+		return;
+
+	if( log_ring ) {
+		__atomic_store_n(&log_stopping, 1, __ATOMIC_RELEASE);
+		pthread_join(log_thread, NULL);
+
+		jack_ringbuffer_free(log_ring);
+		log_ring = NULL;
+	}
+
+	if( log_dropped )
+		printf("timeline: %" PRIu64 " MIDI events didn't make it into the log\n", log_dropped);
+
+	fprintf(log_file, "end %" PRIu64 "\n", end);
+	fclose(log_file);
+	log_file = NULL;
+}
@@ -0,0 +1,253 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sched.h>
+#include <time.h>
+
+#include "engine.h"
+#include "trace.h"
+
+#define TRACE_MAX_THREADS 8
+#define TRACE_RING_SIZE   16384  /* records, has to be a power of two */
+
+typedef struct trace_record trace_record_t;
+typedef struct trace_ring trace_ring_t;
+
+struct trace_record {
+	uint64_t ts;  /* microseconds */
+	uint32_t arg;
+	uint8_t event;
+	char phase;   /* as in chrome's "ph": B, E or i */
+};
+
+struct trace_ring {
+	const char *name;
+	int tid;
+
+	/* only ever written by the owning thread */
+	uint64_t head;
+	trace_record_t *records;
+};
+
+static const char *event_names[] = {
+	[TRACE_PROCESS]      = "process",
+	[TRACE_QUANTIZE]     = "quantize",
+	[TRACE_SEEK]         = "seek",
+	[TRACE_PATTERN_STEP] = "pattern step",
+	[TRACE_INPUT]        = "input",
+	[TRACE_LED]          = "led",
+	[TRACE_DISPLAY]      = "display",
+	[TRACE_SESSION]      = "session"
+};
+
+static int enabled = 0;
+static char *trace_dir;
+
+static trace_ring_t rings[TRACE_MAX_THREADS];
+static int ring_count = 0;
+
+static __thread trace_ring_t *ring = NULL;
+
+static sem_t flush_sem;
+static pthread_t flush_thread;
+
+void trace_thread(const char *name) {
+	int idx;
+
+	if( !enabled || ring )
+		return;
+
+	if( (idx = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED)) >= TRACE_MAX_THREADS )
+		return;
+
+	rings[idx].name = name;
+	rings[idx].tid  = idx + 1;
+	ring = &rings[idx];
+}
+
+static void trace(trace_event_t event, char phase, uint32_t arg) {
+	trace_record_t *r;
+
+	if( !ring )
+		return;
+
+	r = &ring->records[ring->head & (TRACE_RING_SIZE - 1)];
+	r->ts    = engine_time_us();
+	r->arg   = arg;
+	r->event = event;
+	r->phase = phase;
+
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_begin(trace_event_t event, uint32_t arg) {
+	trace(event, 'B', arg);
+}
+
+void trace_end(trace_event_t event, uint32_t arg) {
+	trace(event, 'E', arg);
+}
+
+void trace_instant(trace_event_t event, uint32_t arg) {
+	trace(event, 'i', arg);
+}
+
+/* copies out what the ring holds right now.  the owner keeps writing
+   while we copy, so anything it may have lapped us on is dropped. */
+static uint64_t snapshot(trace_ring_t *r, trace_record_t *out) {
+	uint64_t head, tail, after, i;
+
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	tail = ( head > TRACE_RING_SIZE ) ? head - TRACE_RING_SIZE : 0;
+
+	for( i = tail; i < head; i++ )
+		out[i - tail] = r->records[i & (TRACE_RING_SIZE - 1)];
+
+	/* keeps the copies above from drifting past the second look at
+	   head, which an acquire load on its own wouldn't */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	after = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+	/* the owner may also be halfway through writing record number
+	   "after", which lands on top of (after - TRACE_RING_SIZE). */
+	if( after + 1 - tail <= TRACE_RING_SIZE )
+		return head - tail;
+
+	i = after + 1 - tail - TRACE_RING_SIZE;
+	if( i >= head - tail )
+		return 0;
+
+	memmove(out, out + i, sizeof(trace_record_t) * (head - tail - i));
+	return head - tail - i;
+}
+
+static void write_trace(FILE *f) {
+	trace_record_t *records;
+	uint64_t count, j;
+	int i, threads, first;
+
+	if( !(records = calloc(TRACE_RING_SIZE, sizeof(trace_record_t))) ) {
+		fprintf(stderr, "trace: couldn't allocate records, aieee!\n");
+		return;
+	}
+
+	threads = __atomic_load_n(&ring_count, __ATOMIC_RELAXED);
+	if( threads > TRACE_MAX_THREADS )
+		threads = TRACE_MAX_THREADS;
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	first = 1;
+
+	for( i = 0; i < threads; i++ ) {
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+		           "\"args\":{\"name\":\"%s\"}}",
+		        ( first ) ? "" : ",\n", rings[i].tid, rings[i].name);
+		first = 0;
+
+		count = snapshot(&rings[i], records);
+
+		for( j = 0; j < count; j++ ) {
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ",\"pid\":1,\"tid\":%d",
+			        event_names[records[j].event], records[j].phase, records[j].ts, rings[i].tid);
+
+			if( records[j].phase == 'i' )
+				fprintf(f, ",\"s\":\"t\"");
+
+			fprintf(f, ",\"args\":{\"arg\":%u}}", records[j].arg);
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+	free(records);
+}
+
+static void flush() {
+	char *path;
+	FILE *f;
+
+	if( asprintf(&path, "%s/rove-trace-%ld.json", trace_dir, (long) time(NULL)) < 0 )
+		return;
+
+	if( !(f = fopen(path, "w")) ) {
+		printf("trace: couldn't open %s for writing\n", path);
+		free(path);
+		return;
+	}
+
+	write_trace(f);
+	fclose(f);
+
+	printf("trace: wrote %s\n", path);
+	free(path);
+}
+
+static void *flush_loop(void *user_data) {
+	for(;;) {
+		while( sem_wait(&flush_sem) );
+		flush();
+	}
+
+	return NULL;
+}
+
+static void request_flush(int s) {
+	sem_post(&flush_sem);
+}
+
+int trace_init(const char *dir) {
+	struct sched_param param = {0};
+	pthread_attr_t attr;
+	int i;
+
+	for( i = 0; i < TRACE_MAX_THREADS; i++ )
+		if( !(rings[i].records = calloc(TRACE_RING_SIZE, sizeof(trace_record_t))) ) {
+			fprintf(stderr, "trace: couldn't allocate trace buffers, aieee!\n");
+			return 1;
+		}
+
+	trace_dir = strdup(dir);
+	sem_init(&flush_sem, 0, 0);
+
+	/* writing the file out is the least important thing we do */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+	pthread_attr_setschedparam(&attr, &param);
+
+	if( pthread_create(&flush_thread, &attr, flush_loop, NULL)
+	    && pthread_create(&flush_thread, NULL, flush_loop, NULL) ) {
+		fprintf(stderr, "trace: couldn't start the flush thread, aieee!\n");
+		pthread_attr_destroy(&attr);
+		return 1;
+	}
+
+	pthread_attr_destroy(&attr);
+
+	signal(SIGUSR1, request_flush);
+	enabled = 1;
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "voice.h"
+
+typedef struct voice_block voice_block_t;
+
+struct voice_block {
+	voice_t voices[VOICE_BLOCK];
+	voice_block_t *next;
+};
+
+static voice_block_t *blocks = NULL;
+
+static voice_block_t *block_new() {
+	voice_block_t *self;
+
+	if( posix_memalign((void **) &self, VOICE_ALIGN, sizeof(voice_block_t)) ) {
+		fprintf(stderr, "couldn't allocate voices, aieee!\n");
+		return NULL;
+	}
+
+	memset(self, 0, sizeof(voice_block_t));
+
+	self->next = blocks;
+	blocks = self;
+
+	return self;
+}
+
+/* a voice without a process_cb is free to be handed out again */
+voice_t *voice_new(process_callback_t process_cb) {
+	voice_block_t *b;
+	voice_t *v;
+	int i;
+
+	v = NULL;
+
+	for( b = blocks; b && !v; b = b->next )
+		for( i = 0; i < VOICE_BLOCK; i++ )
+			if( !b->voices[i].process_cb ) {
+				v = &b->voices[i];
+				break;
+			}
+
+	if( !v ) {
+		if( !(b = block_new()) )
+			return NULL;
+
+		v = &b->voices[0];
+	}
+
+	v->process_cb = process_cb;
+	return v;
+}
+
+void voice_free(voice_t *self) {
+	memset(self, 0, sizeof(voice_t));
+}
+
+void voice_set_play_pos(voice_t *self, sf_count_t p) {
+	if( p >= self->file_length )
+		p %= self->file_length;
+
+	if( p < 0 )
+		p = self->file_length - (abs(p) % self->file_length);
+
+	self->play_offset = p;
+}
+
+void voice_inc_play_pos(voice_t *self, sf_count_t delta) {
+	if( self->play_direction == FILE_PLAY_DIRECTION_REVERSE )
+		voice_set_play_pos(self, self->play_offset - delta);
+	else
+		voice_set_play_pos(self, self->play_offset + delta);
+}
@@ -0,0 +1,193 @@
+/**
+ * This file is part of rove.
+ * rove is copyright 2007-2009 william light <visinin@gmail.com>
+ *
+ * rove is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rove is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rove.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#include <jack/jack.h>
+
+#include "xrun.h"
+
+#define XRUN_HISTORY 512  /* cycles, has to be a power of two */
+
+/* how often the page fault counters are sampled.  getrusage() isn't
+   something to call from the JACK thread, so the cycle records pick up
+   whatever the sampler saw last. */
+#define FAULT_SAMPLE_NS 1000000
+
+typedef struct xrun_record xrun_record_t;
+
+struct xrun_record {
+	uint64_t frame;
+	uint64_t ns;
+	jack_time_t usecs;
+
+	jack_nframes_t nframes;
+	int blocks;
+	int voices;
+	int src_voices;
+	int commands;
+
+	long minflt;
+	long majflt;
+};
+
+extern state_t state;
+
+static int enabled = 0;
+static char *xrun_dir;
+
+static xrun_record_t history[XRUN_HISTORY];
+static uint64_t head = 0;
+static int frozen = 0;
+
+static long minflt = 0;
+static long majflt = 0;
+
+static sem_t dump_sem;
+static pthread_t dump_thread, fault_thread;
+
+void xrun_cycle(const engine_cycle_t *cycle, uint64_t ns) {
+	xrun_record_t *r;
+
+	/* leave the history alone until it's been written out */
+	if( !enabled || __atomic_load_n(&frozen, __ATOMIC_ACQUIRE) )
+		return;
+
+	r = &history[head & (XRUN_HISTORY - 1)];
+
+	r->frame      = cycle->start_frame;
+	r->ns         = ns;
+	r->usecs      = jack_get_time();
+	r->nframes    = cycle->nframes;
+	r->blocks     = cycle->blocks;
+	r->voices     = cycle->voices;
+	r->src_voices = cycle->src_voices;
+	r->commands   = cycle->commands;
+	r->minflt     = __atomic_load_n(&minflt, __ATOMIC_RELAXED);
+	r->majflt     = __atomic_load_n(&majflt, __ATOMIC_RELAXED);
+
+	head++;
+}
+
+void xrun_snapshot() {
+	int was_frozen = 0;
+
+	if( !enabled )
+		return;
+
+	/* a burst of xruns only gets written out once */
+	if( __atomic_compare_exchange_n(&frozen, &was_frozen, 1, 0,
+	                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) )
+		sem_post(&dump_sem);
+}
+
+static void dump() {
+	uint64_t i, first, last;
+	xrun_record_t *r, *p;
+	double budget_ns;
+	char *path;
+	FILE *f;
+
+	if( asprintf(&path, "%s/rove-xrun-%ld.txt", xrun_dir, (long) time(NULL)) < 0 )
+		return;
+
+	if( !(f = fopen(path, "w")) ) {
+		printf("xrun: couldn't open %s for writing\n", path);
+		free(path);
+		return;
+	}
+
+	/* the JACK thread stopped writing when we froze, so head is
+	   stable from here on. */
+	last  = head;
+	first = ( last > XRUN_HISTORY ) ? last - XRUN_HISTORY : 0;
+
+	fprintf(f, "# rove xrun snapshot, last %" PRIu64 " cycles before the xrun\n"
+	           "# faults are sampled every %d us, so they can lag a cycle or two\n"
+	           "#\n"
+	           "# %12s %14s %10s %7s %6s %6s %6s %4s %8s %6s %6s\n",
+	        last - first, FAULT_SAMPLE_NS / 1000,
+	        "frame", "jack usecs", "ns", "%", "frames", "blocks", "voices", "src", "commands",
+	        "minflt", "majflt");
+
+	for( i = first, p = NULL; i < last; i++, p = r ) {
+		r = &history[i & (XRUN_HISTORY - 1)];
+		budget_ns = ( state.sample_rate ) ? r->nframes * 1e9 / state.sample_rate : 0;
+
+		fprintf(f, "%14" PRIu64 " %14" PRIu64 " %10" PRIu64 " %7.2f %6u %6d %6d %4d %8d %6ld %6ld\n",
+		        r->frame, (uint64_t) r->usecs, r->ns,
+		        ( budget_ns ) ? 100.0 * r->ns / budget_ns : 0.0,
+		        r->nframes, r->blocks, r->voices, r->src_voices, r->commands,
+		        ( p ) ? r->minflt - p->minflt : 0, ( p ) ? r->majflt - p->majflt : 0);
+	}
+
+	fclose(f);
+
+	printf("xrun: wrote %s\n", path);
+	free(path);
+}
+
+static void *dump_loop(void *user_data) {
+	for(;;) {
+		while( sem_wait(&dump_sem) );
+
+		dump();
+		__atomic_store_n(&frozen, 0, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static void *fault_loop(void *user_data) {
+	struct timespec req = {0, FAULT_SAMPLE_NS};
+	struct rusage usage;
+
+	for(;;) {
+		if( !getrusage(RUSAGE_SELF, &usage) ) {
+			__atomic_store_n(&minflt, usage.ru_minflt, __ATOMIC_RELAXED);
+			__atomic_store_n(&majflt, usage.ru_majflt, __ATOMIC_RELAXED);
+		}
+
+		nanosleep(&req, NULL);
+	}
+
+	return NULL;
+}
+
+int xrun_init(const char *dir) {
+	xrun_dir = strdup(dir);
+	sem_init(&dump_sem, 0, 0);
+
+	if( pthread_create(&dump_thread, NULL, dump_loop, NULL)
+	    || pthread_create(&fault_thread, NULL, fault_loop, NULL) ) {
+		fprintf(stderr, "xrun: couldn't start threads, aieee!\n");
+		return 1;
+	}
+
+	enabled = 1;
+	return 0;
+}